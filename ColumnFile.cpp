@@ -0,0 +1,131 @@
+#include "ColumnFile.h"
+
+#include "log.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+namespace CoolEdit
+{
+namespace ColumnFile
+{
+
+namespace
+{
+
+// The ColumnEntry table ending a header of `header_size` bytes.
+ColumnEntry const *entries(void const *header, size_t header_size, size_t column_count)
+{
+    return reinterpret_cast<ColumnEntry const *>(static_cast<char const *>(header) + header_size -
+                                                 column_count * sizeof(ColumnEntry));
+}
+
+} // namespace
+
+uint32_t element_size(Type type)
+{
+    switch (type)
+    {
+    case Type::uint8:
+    case Type::bytes:
+        return 1;
+    case Type::uint32:
+        return 4;
+    case Type::uint64:
+    case Type::float64:
+        return 8;
+    case Type::string:
+        return sizeof(StringRef);
+    }
+    return 0;
+}
+
+void write(std::string const &path, void *header, size_t header_size, std::vector<Data> const &columns)
+{
+    static_cast<Prefix *>(header)->column_count = (uint32_t)columns.size();
+    auto table = const_cast<ColumnEntry *>(entries(header, header_size, columns.size()));
+    uint64_t offset = header_size;
+    for (size_t i = 0; i < columns.size(); ++i)
+    {
+        auto size = element_size(columns[i].type);
+        table[i] = {offset, columns[i].count, columns[i].type, size};
+        offset += (columns[i].count * size + 7) / 8 * 8;
+    }
+
+    // Named for this process and call, so that writers of the same file,
+    // such as tools caching one session, do not write into each other's.
+    static std::atomic<unsigned> counter{0};
+    auto temporary = FORMAT("%@.%@.%@.tmp", path, ::getpid(), counter++);
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    out.write(static_cast<char const *>(header), header_size);
+    const char padding[8] = {};
+    for (auto &column : columns)
+    {
+        auto size = column.count * element_size(column.type);
+        out.write(static_cast<char const *>(column.data), size);
+        out.write(padding, (8 - size % 8) % 8);
+    }
+    // Closed first, as whatever is still buffered may fail to be written too.
+    out.close();
+    if (out.fail())
+    {
+        ::unlink(temporary.c_str());
+        THROW("Cannot write %@", temporary);
+    }
+    if (::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        auto error = errno;
+        ::unlink(temporary.c_str());
+        THROW("Cannot replace %@: %@", path, std::strerror(error));
+    }
+}
+
+bool is_valid(void const *data, size_t size, size_t header_size, char const *magic, uint32_t version,
+              std::vector<Type> const &types)
+{
+    auto count = types.size();
+    if (size < header_size || header_size < sizeof(Prefix) + count * sizeof(ColumnEntry) || types.empty() ||
+        types.back() != Type::bytes)
+    {
+        return false;
+    }
+    auto &prefix = *static_cast<Prefix const *>(data);
+    if (std::memcmp(prefix.magic, magic, sizeof(prefix.magic)) != 0 || prefix.version != version ||
+        prefix.column_count != count)
+    {
+        return false;
+    }
+    auto columns = entries(data, header_size, count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto &column = columns[i];
+        if (column.type != types[i] || column.element_size != element_size(types[i]) || column.offset % 8 != 0 ||
+            column.offset > size || column.count > (size - column.offset) / column.element_size)
+        {
+            return false;
+        }
+    }
+    auto bytes = static_cast<uint8_t const *>(data);
+    auto strings_size = columns[count - 1].count;
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto refs = reinterpret_cast<StringRef const *>(bytes + columns[i].offset);
+        if (types[i] == Type::string &&
+            !std::all_of(refs, refs + columns[i].count, [&](StringRef const &ref)
+            {
+                return ref.offset <= strings_size && ref.length <= strings_size - ref.offset;
+            }))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace ColumnFile
+} // namespace CoolEdit
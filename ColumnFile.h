@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace CoolEdit
+{
+
+// Files of typed columns that are mapped and read in place, such as session
+// catalogs (SessionCatalog.h) and sessions as columns (SessionColumns.h).
+//
+// A file is a header followed by its columns in order. The header starts with
+// a Prefix and ends with a ColumnEntry per column; what lies between is up to
+// the format. Each column is a packed array of `count` values of its type, in
+// the machine's byte order, starting at `offset` from the start of the file,
+// which is a multiple of 8; padding is zero. The last column holds the bytes
+// of every string, which StringRefs point into; strings are not
+// NUL-terminated.
+namespace ColumnFile
+{
+
+enum class Type : uint32_t
+{
+    uint8,
+    uint32,
+    uint64,
+    float64,
+    string, // StringRef
+    bytes,  // char, the last column only
+};
+
+struct StringRef
+{
+    uint64_t offset; // into the last column
+    uint64_t length;
+};
+
+struct ColumnEntry
+{
+    uint64_t offset; // from the start of the file
+    uint64_t count;  // values
+    Type type;
+    uint32_t element_size; // bytes per value
+};
+
+struct Prefix
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t column_count;
+};
+
+// A column to be written.
+struct Data
+{
+    Type type;
+    void const *data;
+    uint64_t count; // values
+};
+
+// Bytes per value of `type`.
+uint32_t element_size(Type type);
+
+// Writes `header` and `columns` to `path`, replacing it by renaming, so that
+// readers see either the old file or the new one, and writers racing to
+// replace it leave one whole file behind. The caller fills in the magic and
+// version; the column count and the ColumnEntry table ending the header are
+// filled in here. Throws exception if the file cannot be written.
+void write(std::string const &path, void *header, size_t header_size, std::vector<Data> const &columns);
+
+template <typename Header>
+void write(std::string const &path, Header &header, std::vector<Data> const &columns)
+{
+    write(path, &header, sizeof(Header), columns);
+}
+
+// Whether `data` starts with a header of `header_size` bytes with `magic`,
+// `version` and a column of every type in `types`, and whether every column
+// and string stays in bounds. What the columns hold is for the format to
+// check.
+bool is_valid(void const *data, size_t size, size_t header_size, char const *magic, uint32_t version,
+              std::vector<Type> const &types);
+
+} // namespace ColumnFile
+
+} // namespace CoolEdit
@@ -0,0 +1,462 @@
+#include "Gain.h"
+
+#include "log.h"
+#include "simd.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace Gain
+{
+
+namespace
+{
+
+const float INT16_LIMIT = 32767;
+const float INT24_LIMIT = 8388607;
+
+// Samples of a 24-bit chunk widened to 32 bits at a time.
+const size_t INT24_BATCH = 256;
+
+const size_t CHUNK_FRAMES = 1 << 16;
+
+int32_t scale(int32_t sample, float gain, float limit)
+{
+    auto value = std::min(std::max(sample * gain, -limit - 1), limit);
+    return (int32_t)std::lrint(value);
+}
+
+// The kernels below start at a frame boundary and step by an even number of
+// samples, so a vector of alternating gains lines up with stereo channels.
+
+void scalar_float32(float *samples, size_t begin, size_t end, unsigned channels, float const *gains)
+{
+    for (size_t i = begin; i < end; ++i)
+    {
+        samples[i] *= gains[i % channels];
+    }
+}
+
+void scalar_int16(int16_t *samples, size_t begin, size_t end, unsigned channels, float const *gains)
+{
+    for (size_t i = begin; i < end; ++i)
+    {
+        samples[i] = (int16_t)scale(samples[i], gains[i % channels], INT16_LIMIT);
+    }
+}
+
+void scalar_int32(int32_t *samples, size_t begin, size_t end, unsigned channels, float const *gains, float limit)
+{
+    for (size_t i = begin; i < end; ++i)
+    {
+        samples[i] = scale(samples[i], gains[i % channels], limit);
+    }
+}
+
+#if SIMD_AVX2
+SIMD_TARGET_AVX2 size_t avx2_float32(float *samples, size_t count, float left, float right)
+{
+    auto gain = _mm256_setr_ps(left, right, left, right, left, right, left, right);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        _mm256_storeu_ps(samples + i, _mm256_mul_ps(_mm256_loadu_ps(samples + i), gain));
+    }
+    return i;
+}
+
+SIMD_TARGET_AVX2 __m256i avx2_scale(__m256i values, __m256 gain, __m256 low, __m256 high)
+{
+    auto scaled = _mm256_mul_ps(_mm256_cvtepi32_ps(values), gain);
+    return _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(scaled, low), high));
+}
+
+SIMD_TARGET_AVX2 size_t avx2_int16(int16_t *samples, size_t count, float left, float right)
+{
+    auto gain = _mm256_setr_ps(left, right, left, right, left, right, left, right);
+    auto low = _mm256_set1_ps(-INT16_LIMIT - 1);
+    auto high = _mm256_set1_ps(INT16_LIMIT);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        auto packed = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(samples + i));
+        auto first = avx2_scale(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(packed)), gain, low, high);
+        auto second = avx2_scale(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(packed, 1)), gain, low, high);
+        // packs works within 128-bit lanes; put the quarters back in order.
+        auto result = _mm256_permute4x64_epi64(_mm256_packs_epi32(first, second), 0xd8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(samples + i), result);
+    }
+    return i;
+}
+
+SIMD_TARGET_AVX2 size_t avx2_int32(int32_t *samples, size_t count, float left, float right, float limit)
+{
+    auto gain = _mm256_setr_ps(left, right, left, right, left, right, left, right);
+    auto low = _mm256_set1_ps(-limit - 1);
+    auto high = _mm256_set1_ps(limit);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        auto p = reinterpret_cast<__m256i *>(samples + i);
+        _mm256_storeu_si256(p, avx2_scale(_mm256_loadu_si256(p), gain, low, high));
+    }
+    return i;
+}
+#endif
+
+#if SIMD_SSE2
+__m128i sse2_scale(__m128i values, __m128 gain, __m128 low, __m128 high)
+{
+    auto scaled = _mm_mul_ps(_mm_cvtepi32_ps(values), gain);
+    return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(scaled, low), high));
+}
+#endif
+
+void apply_float32(float *samples, size_t count, unsigned channels, float const *gains)
+{
+    size_t i = 0;
+    auto left = gains[0], right = gains[channels > 1 ? 1 : 0];
+#if SIMD_AVX2
+    if (simd_has_avx2())
+    {
+        i = avx2_float32(samples, count, left, right);
+    }
+#endif
+#if SIMD_SSE2
+    auto gain = _mm_setr_ps(left, right, left, right);
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), gain));
+    }
+#elif SIMD_NEON
+    float const pattern[4] = {left, right, left, right};
+    auto gain = vld1q_f32(pattern);
+    for (; i + 4 <= count; i += 4)
+    {
+        vst1q_f32(samples + i, vmulq_f32(vld1q_f32(samples + i), gain));
+    }
+#endif
+    scalar_float32(samples, i, count, channels, gains);
+}
+
+void apply_int16(int16_t *samples, size_t count, unsigned channels, float const *gains)
+{
+    size_t i = 0;
+    auto left = gains[0], right = gains[channels > 1 ? 1 : 0];
+#if SIMD_AVX2
+    if (simd_has_avx2())
+    {
+        i = avx2_int16(samples, count, left, right);
+    }
+#endif
+#if SIMD_SSE2
+    auto gain = _mm_setr_ps(left, right, left, right);
+    auto low = _mm_set1_ps(-INT16_LIMIT - 1);
+    auto high = _mm_set1_ps(INT16_LIMIT);
+    for (; i + 8 <= count; i += 8)
+    {
+        auto p = reinterpret_cast<__m128i *>(samples + i);
+        auto packed = _mm_loadu_si128(p);
+        // Widen by placing each sample in the top half and shifting back down.
+        auto first = sse2_scale(_mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16), gain, low, high);
+        auto second = sse2_scale(_mm_srai_epi32(_mm_unpackhi_epi16(packed, packed), 16), gain, low, high);
+        _mm_storeu_si128(p, _mm_packs_epi32(first, second));
+    }
+#elif SIMD_NEON && defined(__aarch64__)
+    float const pattern[4] = {left, right, left, right};
+    auto gain = vld1q_f32(pattern);
+    auto low = vdupq_n_f32(-INT16_LIMIT - 1);
+    auto high = vdupq_n_f32(INT16_LIMIT);
+    for (; i + 8 <= count; i += 8)
+    {
+        auto packed = vld1q_s16(samples + i);
+        auto first = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(packed))), gain);
+        auto second = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(packed))), gain);
+        first = vminq_f32(vmaxq_f32(first, low), high);
+        second = vminq_f32(vmaxq_f32(second, low), high);
+        vst1q_s16(samples + i, vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(first)), vqmovn_s32(vcvtnq_s32_f32(second))));
+    }
+#endif
+    scalar_int16(samples, i, count, channels, gains);
+}
+
+void apply_int32(int32_t *samples, size_t count, unsigned channels, float const *gains, float limit)
+{
+    size_t i = 0;
+    auto left = gains[0], right = gains[channels > 1 ? 1 : 0];
+#if SIMD_AVX2
+    if (simd_has_avx2())
+    {
+        i = avx2_int32(samples, count, left, right, limit);
+    }
+#endif
+#if SIMD_SSE2
+    auto gain = _mm_setr_ps(left, right, left, right);
+    auto low = _mm_set1_ps(-limit - 1);
+    auto high = _mm_set1_ps(limit);
+    for (; i + 4 <= count; i += 4)
+    {
+        auto p = reinterpret_cast<__m128i *>(samples + i);
+        _mm_storeu_si128(p, sse2_scale(_mm_loadu_si128(p), gain, low, high));
+    }
+#elif SIMD_NEON && defined(__aarch64__)
+    float const pattern[4] = {left, right, left, right};
+    auto gain = vld1q_f32(pattern);
+    auto low = vdupq_n_f32(-limit - 1);
+    auto high = vdupq_n_f32(limit);
+    for (; i + 4 <= count; i += 4)
+    {
+        auto scaled = vmulq_f32(vcvtq_f32_s32(vld1q_s32(samples + i)), gain);
+        vst1q_s32(samples + i, vcvtnq_s32_f32(vminq_f32(vmaxq_f32(scaled, low), high)));
+    }
+#endif
+    scalar_int32(samples, i, count, channels, gains, limit);
+}
+
+// There is no vector load for three-byte samples, so these are widened to
+// 32 bits a batch at a time, scaled there and packed back.
+void apply_int24(uint8_t *samples, size_t count, unsigned channels, float const *gains)
+{
+    int32_t wide[INT24_BATCH];
+    // Keep batches a whole number of frames so channel gains stay aligned.
+    auto batch = INT24_BATCH - INT24_BATCH % channels;
+    for (size_t begin = 0; begin < count; begin += batch)
+    {
+        auto size = std::min(batch, count - begin);
+        auto p = samples + begin * 3;
+        for (size_t i = 0; i < size; ++i, p += 3)
+        {
+            wide[i] = int32_t(uint32_t(p[0]) << 8 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 24) >> 8;
+        }
+        if (channels > 2)
+        {
+            scalar_int32(wide, 0, size, channels, gains, INT24_LIMIT);
+        }
+        else
+        {
+            apply_int32(wide, size, channels, gains, INT24_LIMIT);
+        }
+        p = samples + begin * 3;
+        for (size_t i = 0; i < size; ++i, p += 3)
+        {
+            p[0] = uint8_t(wide[i]);
+            p[1] = uint8_t(wide[i] >> 8);
+            p[2] = uint8_t(wide[i] >> 16);
+        }
+    }
+}
+
+} // namespace
+
+void apply(void *samples, size_t frames, unsigned channels, SampleFormat format, float const *gains)
+{
+    auto count = frames * channels;
+    if (channels > 2)
+    {
+        // The vector kernels only know mono and stereo gain patterns.
+        switch (format)
+        {
+        case SampleFormat::int16:
+            return scalar_int16(static_cast<int16_t *>(samples), 0, count, channels, gains);
+        case SampleFormat::float32:
+            return scalar_float32(static_cast<float *>(samples), 0, count, channels, gains);
+        case SampleFormat::int24:
+            break;
+        }
+    }
+    switch (format)
+    {
+    case SampleFormat::int16:
+        return apply_int16(static_cast<int16_t *>(samples), count, channels, gains);
+    case SampleFormat::int24:
+        return apply_int24(static_cast<uint8_t *>(samples), count, channels, gains);
+    case SampleFormat::float32:
+        return apply_float32(static_cast<float *>(samples), count, channels, gains);
+    }
+}
+
+namespace
+{
+
+#if SIMD_AVX2
+SIMD_TARGET_AVX2 size_t avx2_mix_stereo(float *out, float const *in, size_t frames, float left, float right)
+{
+    auto gain = _mm256_setr_ps(left, right, left, right, left, right, left, right);
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4)
+    {
+        auto sum = _mm256_add_ps(_mm256_loadu_ps(out + 2 * i), _mm256_mul_ps(_mm256_loadu_ps(in + 2 * i), gain));
+        _mm256_storeu_ps(out + 2 * i, sum);
+    }
+    return i;
+}
+
+SIMD_TARGET_AVX2 size_t avx2_mix_mono(float *out, float const *in, size_t frames, float left, float right)
+{
+    auto gain = _mm256_setr_ps(left, right, left, right, left, right, left, right);
+    auto spread = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4)
+    {
+        auto mono = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(_mm_loadu_ps(in + i)), spread);
+        auto sum = _mm256_add_ps(_mm256_loadu_ps(out + 2 * i), _mm256_mul_ps(mono, gain));
+        _mm256_storeu_ps(out + 2 * i, sum);
+    }
+    return i;
+}
+#endif
+
+} // namespace
+
+void mix_stereo(float *out, float const *in, size_t frames, float left, float right)
+{
+    size_t i = 0;
+#if SIMD_AVX2
+    if (simd_has_avx2())
+    {
+        i = avx2_mix_stereo(out, in, frames, left, right);
+    }
+#endif
+#if SIMD_SSE2
+    auto gain = _mm_setr_ps(left, right, left, right);
+    for (; i + 2 <= frames; i += 2)
+    {
+        _mm_storeu_ps(out + 2 * i, _mm_add_ps(_mm_loadu_ps(out + 2 * i), _mm_mul_ps(_mm_loadu_ps(in + 2 * i), gain)));
+    }
+#elif SIMD_NEON
+    float const pattern[4] = {left, right, left, right};
+    auto gain = vld1q_f32(pattern);
+    for (; i + 2 <= frames; i += 2)
+    {
+        vst1q_f32(out + 2 * i, vmlaq_f32(vld1q_f32(out + 2 * i), vld1q_f32(in + 2 * i), gain));
+    }
+#endif
+    for (; i < frames; ++i)
+    {
+        out[2 * i] += in[2 * i] * left;
+        out[2 * i + 1] += in[2 * i + 1] * right;
+    }
+}
+
+void mix_mono(float *out, float const *in, size_t frames, float left, float right)
+{
+    size_t i = 0;
+#if SIMD_AVX2
+    if (simd_has_avx2())
+    {
+        i = avx2_mix_mono(out, in, frames, left, right);
+    }
+#endif
+#if SIMD_SSE2
+    auto gain = _mm_setr_ps(left, right, left, right);
+    for (; i + 4 <= frames; i += 4)
+    {
+        auto mono = _mm_loadu_ps(in + i);
+        auto first = _mm_mul_ps(_mm_unpacklo_ps(mono, mono), gain);
+        auto second = _mm_mul_ps(_mm_unpackhi_ps(mono, mono), gain);
+        _mm_storeu_ps(out + 2 * i, _mm_add_ps(_mm_loadu_ps(out + 2 * i), first));
+        _mm_storeu_ps(out + 2 * i + 4, _mm_add_ps(_mm_loadu_ps(out + 2 * i + 4), second));
+    }
+#elif SIMD_NEON
+    float const pattern[4] = {left, right, left, right};
+    auto gain = vld1q_f32(pattern);
+    for (; i + 4 <= frames; i += 4)
+    {
+        auto pairs = vzipq_f32(vld1q_f32(in + i), vld1q_f32(in + i));
+        vst1q_f32(out + 2 * i, vmlaq_f32(vld1q_f32(out + 2 * i), pairs.val[0], gain));
+        vst1q_f32(out + 2 * i + 4, vmlaq_f32(vld1q_f32(out + 2 * i + 4), pairs.val[1], gain));
+    }
+#endif
+    for (; i < frames; ++i)
+    {
+        out[2 * i] += in[i] * left;
+        out[2 * i + 1] += in[i] * right;
+    }
+}
+
+void render(WaveFile::Info const &info, std::string const &in, std::string const &out, uint64_t first_frame,
+            uint64_t frames, float left, float right)
+{
+    auto container = info.channels ? info.block_align / info.channels : 0;
+    SampleFormat format;
+    if (info.encoding == WaveFile::Encoding::pcm && container == 2)
+    {
+        format = SampleFormat::int16;
+    }
+    else if (info.encoding == WaveFile::Encoding::pcm && container == 3)
+    {
+        format = SampleFormat::int24;
+    }
+    else if (info.encoding == WaveFile::Encoding::ieee_float && container == 4)
+    {
+        format = SampleFormat::float32;
+    }
+    else
+    {
+        THROW("Cannot apply gain to %@: %@ bit samples are not supported", in, info.bits_per_sample);
+    }
+
+    WaveFile::Reader reader(in);
+    if (first_frame + frames > reader.info().frames)
+    {
+        THROW("Cannot render frames %@ to %@ of %@", first_frame, first_frame + frames, in);
+    }
+    reader.seek(first_frame);
+
+    // Cool Edit pans mono blocks with their two volumes, which takes a
+    // second channel to keep.
+    auto widen = info.channels == 1 && left != right;
+    auto channels = widen ? 2 : info.channels;
+    std::vector<float> gains(channels);
+    for (unsigned channel = 0; channel < channels; ++channel)
+    {
+        gains[channel] = channel % 2 ? right : left;
+    }
+
+    auto temporary = out + ".part";
+    try
+    {
+        WaveFile::Writer writer(temporary, info.sample_rate, channels, info.encoding, container * 8);
+        std::vector<uint8_t> buffer(CHUNK_FRAMES * container * channels);
+        while (frames)
+        {
+            auto count = reader.read_raw(buffer.data(), (size_t)std::min<uint64_t>(frames, CHUNK_FRAMES));
+            if (count == 0)
+            {
+                THROW("Unexpected end of %@", in);
+            }
+            if (widen)
+            {
+                // Back to front, so that no sample is overwritten before it is copied.
+                for (auto i = count; i-- > 0;)
+                {
+                    std::memcpy(&buffer[(2 * i + 1) * container], &buffer[i * container], container);
+                    std::memcpy(&buffer[2 * i * container], &buffer[i * container], container);
+                }
+            }
+            apply(buffer.data(), count, channels, format, gains.data());
+            writer.write_raw(buffer.data(), count);
+            frames -= count;
+        }
+        writer.finish();
+    }
+    catch (...)
+    {
+        ::unlink(temporary.c_str());
+        throw;
+    }
+    if (::rename(temporary.c_str(), out.c_str()) != 0)
+    {
+        auto error = errno;
+        ::unlink(temporary.c_str());
+        THROW("Cannot replace %@: %@", out, std::strerror(error));
+    }
+}
+
+} // namespace Gain
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "WaveFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Gain
+{
+
+enum class SampleFormat
+{
+    int16,
+    int24,   // packed, three bytes per sample
+    float32,
+};
+
+// Multiplies interleaved samples in place by gains[channel], rounding and
+// saturating the integer formats.
+void apply(void *samples, size_t frames, unsigned channels, SampleFormat format, float const *gains);
+
+// Adds interleaved stereo `in`, scaled by left and right, to interleaved
+// stereo `out`.
+void mix_stereo(float *out, float const *in, size_t frames, float left, float right);
+
+// Adds mono `in`, scaled by left and right, to interleaved stereo `out`.
+void mix_mono(float *out, float const *in, size_t frames, float left, float right);
+
+// Writes frames [first_frame, first_frame + frames) of the wave file at `in`
+// to `out` scaled by `left` and `right`, in the source's format. A mono
+// source comes out as stereo unless both gains are equal. Throws exception on
+// I/O errors and for formats other than 16-bit and 24-bit PCM and 32-bit
+// float.
+void render(WaveFile::Info const &info, std::string const &in, std::string const &out, uint64_t first_frame,
+            uint64_t frames, float left, float right);
+
+} // namespace Gain
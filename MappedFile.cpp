@@ -0,0 +1,59 @@
+#include "MappedFile.h"
+
+#include "log.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+MappedFile::MappedFile(std::string const &path)
+    : _data(nullptr)
+    , _size(0)
+{
+    auto fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        THROW("Cannot open %@: %@", path, std::strerror(errno));
+    }
+    struct stat status;
+    if (::fstat(fd, &status) != 0)
+    {
+        auto error = errno;
+        ::close(fd);
+        THROW("Cannot stat %@: %@", path, std::strerror(error));
+    }
+    _size = (size_t)status.st_size;
+    if (_size)
+    {
+        auto data = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            auto error = errno;
+            ::close(fd);
+            THROW("Cannot map %@: %@", path, std::strerror(error));
+        }
+        _data = static_cast<const uint8_t *>(data);
+    }
+    // The mapping keeps the file referenced on its own.
+    ::close(fd);
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+    : _data(other._data)
+    , _size(other._size)
+{
+    other._data = nullptr;
+    other._size = 0;
+}
+
+MappedFile::~MappedFile()
+{
+    if (_data)
+    {
+        ::munmap(const_cast<uint8_t *>(_data), _size);
+    }
+}
@@ -0,0 +1,295 @@
+#include "Mix.h"
+
+#include "Gain.h"
+#include "MappedFile.h"
+#include "Timeline.h"
+#include "WaveFile.h"
+#include "log.h"
+#include "parallel.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+using namespace CoolEdit;
+
+namespace Mix
+{
+
+namespace
+{
+
+// Output frames summed at a time: one worker's share of a mix, or one step
+// through a stem.
+const size_t WINDOW_FRAMES = 1 << 16;
+
+// Source frames converted to float at a time, small enough to stay in cache.
+const size_t DECODE_FRAMES = 1 << 12;
+
+struct Source
+{
+    WaveFile::Info info;
+    std::unique_ptr<MappedFile> file;
+    uint64_t frames; // as many as the mapping holds, even if the header promises more
+};
+
+// A block ready to mix, in session frames.
+struct Voice
+{
+    uint64_t start;
+    uint64_t end;
+    uint64_t wave_offset;
+    Source const *source;
+    float left;
+    float right;
+};
+
+void mix_voice(Voice const &voice, uint64_t begin, uint64_t end, float *out, std::vector<float> &decoded,
+               std::vector<float> &stereo)
+{
+    auto &info = voice.source->info;
+    auto data = voice.source->file->data() + info.data_offset;
+    decoded.resize(DECODE_FRAMES * info.channels);
+    for (auto position = begin; position < end;)
+    {
+        auto frames = (size_t)std::min<uint64_t>(end - position, DECODE_FRAMES);
+        auto wave_frame = voice.wave_offset + (position - voice.start);
+        WaveFile::decode(info, data + wave_frame * info.block_align, frames, decoded.data());
+        if (info.channels == 1)
+        {
+            Gain::mix_mono(out, decoded.data(), frames, voice.left, voice.right);
+        }
+        else if (info.channels == 2)
+        {
+            Gain::mix_stereo(out, decoded.data(), frames, voice.left, voice.right);
+        }
+        else
+        {
+            // Beyond stereo, only the first two channels have a place to go.
+            stereo.resize(DECODE_FRAMES * 2);
+            for (size_t i = 0; i < frames; ++i)
+            {
+                stereo[2 * i] = decoded[i * info.channels];
+                stereo[2 * i + 1] = decoded[i * info.channels + 1];
+            }
+            Gain::mix_stereo(out, stereo.data(), frames, voice.left, voice.right);
+        }
+        out += 2 * frames;
+        position += frames;
+    }
+}
+
+using SourceIndex = std::unordered_map<unsigned, Source const *>;
+
+// Maps every usable wave, keyed by wave id.
+std::vector<Source> open_sources(Session const &session, std::vector<std::string> const &wave_paths,
+                                 SourceIndex &index, unsigned threads)
+{
+    std::vector<Source> sources(session.waves.size());
+    parallel_for(sources.size(), [&](size_t i)
+    {
+        auto &source = sources[i];
+        source.info = WaveFile::probe(wave_paths[i]);
+        if (!WaveFile::is_decodable(source.info))
+        {
+            logw("Leaving out %@: not a readable wave file", wave_paths[i]);
+            return;
+        }
+        if (source.info.sample_rate != session.sample_rate)
+        {
+            logw("Leaving out %@: %@ Hz in a %@ Hz session", wave_paths[i], source.info.sample_rate,
+                 session.sample_rate);
+            return;
+        }
+        try
+        {
+            source.file.reset(new MappedFile(wave_paths[i]));
+        }
+        catch (std::exception const &e)
+        {
+            logw("Leaving out %@: %@", wave_paths[i], e.what());
+            return;
+        }
+        auto available = source.file->size() - std::min<uint64_t>(source.file->size(), source.info.data_offset);
+        source.frames = std::min(source.info.frames, available / source.info.block_align);
+    }, threads);
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        if (sources[i].file)
+        {
+            index[session.waves[i].id] = &sources[i];
+        }
+    }
+    return sources;
+}
+
+// Frames up to the end of the last block, played or not.
+uint64_t session_length(Session const &session)
+{
+    uint64_t length = 0;
+    for (auto &block : session.blocks)
+    {
+        length = std::max<uint64_t>(length, (uint64_t)block.offset_samples + block.size_samples);
+    }
+    return length;
+}
+
+// What is heard of unmuted tracks, sorted by start. With a track number,
+// that track's, muted or not, as the project still holds its clips; without
+// the master volume, as for stems.
+std::vector<Voice> collect_voices(Session const &session, std::vector<TrackTimeline> const &timelines,
+                                  SourceIndex const &sources, size_t only_track, bool master)
+{
+    std::vector<Voice> voices;
+    for (size_t i = 0; i < timelines.size(); ++i)
+    {
+        auto &track = session.tracks[i];
+        if (only_track ? i + 1 != only_track : track.mute)
+        {
+            continue;
+        }
+        for (auto &segment : timelines[i].segments())
+        {
+            auto &block = session.blocks[segment.block];
+            auto source = sources.find(block.wave_id);
+            if (source == sources.end())
+            {
+                continue;
+            }
+            Voice voice;
+            voice.start = segment.start;
+            voice.wave_offset = segment.wave_offset;
+            auto available = source->second->frames - std::min<uint64_t>(source->second->frames, voice.wave_offset);
+            voice.end = voice.start + std::min<uint64_t>(segment.end - segment.start, available);
+            voice.source = source->second;
+            voice.left = float(block.left_volume * track.left_volume * (master ? session.master_volume : 1));
+            voice.right = float(block.right_volume * track.right_volume * (master ? session.master_volume_right : 1));
+            if (voice.end > voice.start)
+            {
+                voices.push_back(voice);
+            }
+        }
+    }
+    sort(voices.begin(), voices.end(), [](Voice const &a, Voice const &b) { return a.start < b.start; });
+    return voices;
+}
+
+// Sums the voices over frames [begin, end) into mix, which must hold that
+// many zeroed stereo frames.
+void mix_window(std::vector<Voice> const &voices, uint64_t begin, uint64_t end, float *mix,
+                std::vector<float> &decoded, std::vector<float> &stereo)
+{
+    for (auto &voice : voices)
+    {
+        if (voice.start >= end)
+        {
+            break;
+        }
+        auto first = std::max(begin, voice.start);
+        auto last = std::min(end, voice.end);
+        if (first < last)
+        {
+            mix_voice(voice, first, last, mix + 2 * (first - begin), decoded, stereo);
+        }
+    }
+}
+
+// Writes a stereo wave file at the session's rate to `out` with `fill`,
+// through `out` + ".part", so that a failed render leaves no partial file.
+template <typename F>
+void write_wave(Session const &session, std::string const &out, F const &fill)
+{
+    auto temporary = out + ".part";
+    try
+    {
+        WaveFile::Writer writer(temporary, session.sample_rate, 2);
+        fill(writer);
+        writer.finish();
+    }
+    catch (...)
+    {
+        ::unlink(temporary.c_str());
+        throw;
+    }
+    if (::rename(temporary.c_str(), out.c_str()) != 0)
+    {
+        auto error = errno;
+        ::unlink(temporary.c_str());
+        THROW("Cannot replace %@: %@", out, std::strerror(error));
+    }
+}
+
+} // namespace
+
+void render(Session const &session, std::vector<std::string> const &wave_paths, std::string const &out,
+            unsigned threads)
+{
+    auto started = std::chrono::steady_clock::now();
+
+    SourceIndex index;
+    auto sources = open_sources(session, wave_paths, index, threads);
+    auto voices = collect_voices(session, build_timelines(session), index, 0, true);
+    auto length = session_length(session);
+
+    write_wave(session, out, [&](WaveFile::Writer &writer)
+    {
+        std::mutex writer_mutex;
+        auto slices = (length + WINDOW_FRAMES - 1) / WINDOW_FRAMES;
+        parallel_for(slices, [&](size_t slice)
+        {
+            auto begin = slice * WINDOW_FRAMES;
+            auto end = std::min<uint64_t>(begin + WINDOW_FRAMES, length);
+            std::vector<float> mix(2 * (end - begin)), decoded, stereo;
+            mix_window(voices, begin, end, mix.data(), decoded, stereo);
+            std::lock_guard<std::mutex> lock(writer_mutex);
+            writer.write_raw_at(begin, mix.data(), end - begin);
+        }, threads);
+    });
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    logi("Mixed %@ blocks, %@ s of audio, in %@ s", voices.size(), length / (double)session.sample_rate, elapsed);
+}
+
+void render_stems(Session const &session, std::vector<std::string> const &wave_paths,
+                  std::vector<std::string> const &stem_paths, unsigned threads)
+{
+    auto started = std::chrono::steady_clock::now();
+
+    SourceIndex index;
+    auto sources = open_sources(session, wave_paths, index, threads);
+    auto length = session_length(session);
+    auto timelines = build_timelines(session);
+
+    parallel_for(session.tracks.size(), [&](size_t i)
+    {
+        if (stem_paths[i].empty())
+        {
+            return;
+        }
+        auto voices = collect_voices(session, timelines, index, i + 1, false);
+        write_wave(session, stem_paths[i], [&](WaveFile::Writer &writer)
+        {
+            std::vector<float> mix, decoded, stereo;
+            for (uint64_t begin = 0; begin < length; begin += WINDOW_FRAMES)
+            {
+                auto end = std::min<uint64_t>(begin + WINDOW_FRAMES, length);
+                mix.assign(2 * (end - begin), 0.0f);
+                mix_window(voices, begin, end, mix.data(), decoded, stereo);
+                writer.write_raw(mix.data(), end - begin);
+            }
+        });
+    }, threads);
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    auto stems = count_if(stem_paths.begin(), stem_paths.end(), [](std::string const &path) { return !path.empty(); });
+    logi("Rendered %@ stems, %@ s of audio each, in %@ s", stems, length / (double)session.sample_rate, elapsed);
+}
+
+} // namespace Mix
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "SessionFile.h"
+
+#include <string>
+#include <vector>
+
+namespace Mix
+{
+
+// Renders the session as Cool Edit plays it: every block of an unmuted track
+// at its offset, scaled by block, track and master volumes, summed to 32-bit
+// float stereo at the session rate and written to `out`. wave_paths holds the
+// file of each of session.waves, in order. Blocks whose wave is missing,
+// unreadable or at another rate are left out with a warning. `out` is
+// replaced only once the mix is complete. Throws exception if it cannot be
+// written.
+void render(CoolEdit::Session const &session, std::vector<std::string> const &wave_paths, std::string const &out,
+            unsigned threads = 0);
+
+// Renders every track on its own to stem_paths[track index], like render
+// but without the master volume, one worker per track. Muted tracks get stems
+// too, as their clips are still in the project. Every stem covers the whole
+// session so that they line up; an empty path skips its track.
+void render_stems(CoolEdit::Session const &session, std::vector<std::string> const &wave_paths,
+                  std::vector<std::string> const &stem_paths, unsigned threads = 0);
+
+} // namespace Mix
@@ -1,4 +1,8 @@
+#include "SessionCache.h"
+#include "SessionColumns.h"
 #include "SessionFile.h"
+#include "log.h"
+#include "parallel.h"
 
 #include "json.hpp"
 
@@ -8,13 +12,75 @@
 
 using namespace CoolEdit;
 
+namespace
+{
+
+// Prints one JSON line per file, in argument order, with the header fields or
+// the error. Files are probed in parallel.
+int probe(std::vector<std::string> const &paths)
+{
+    std::vector<ProbeResult> results(paths.size());
+    parallel_for(paths.size(), [&](size_t i) { results[i] = probe_session(paths[i]); });
+
+    int status = 0;
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        nlohmann::json line;
+        if (results[i].status.ok())
+        {
+            line = results[i].header;
+        }
+        else
+        {
+            line["error"] = results[i].status.message();
+            status = 1;
+        }
+        line["path"] = paths[i];
+        std::cout << line << '\n';
+    }
+    return status;
+}
+
+} // namespace
+
 int main(int argc, char **argv) {
+    logging::configure_from_environment();
+
     std::vector<std::string> args(argv, argv + argc);
-    if (args.size() != 2)
+    if (args.size() > 2 && args[1] == "--probe")
     {
-        std::cerr << "Usage: " << args[0] << " <path/to/sesfile>\n";
+        return probe({args.begin() + 2, args.end()});
+    }
+    // --columns <file> writes the session as columns instead of JSON.
+    auto columns = args.size() == 4 && args[1] == "--columns";
+    // --cache <dir> reads the session through a cache of it in <dir>.
+    auto cache = args.size() == 4 && args[1] == "--cache";
+    if (args.size() != 2 && !columns && !cache)
+    {
+        std::cerr << "Usage: " << args[0] << " <path/to/sesfile>\n"
+                  << "       " << args[0] << " --probe <path/to/sesfile>...\n"
+                  << "       " << args[0] << " --columns <path/to/columns file> <path/to/sesfile>\n"
+                  << "       " << args[0] << " --cache <cache dir> <path/to/sesfile>\n";
+        return 1;
+    }
+    if (cache)
+    {
+        SessionCache cached(args[3], args[2]);
+        logi("%@ %@", cached.reused() ? "Reused" : "Wrote", SessionCache::path(args[3], args[2]));
+        std::cout << nlohmann::json(cached.session());
+        return 0;
+    }
+    auto &path = args.back();
+    auto result = try_load_session(path);
+    if (!result.status.ok())
+    {
+        std::cerr << path << ": " << result.status.message() << '\n';
         return 1;
     }
-    auto file = load_session(args[1]);
-    std::cout << nlohmann::json(file);
+    if (columns)
+    {
+        Columns::write(result.session, args[2]);
+        return 0;
+    }
+    std::cout << nlohmann::json(result.session);
 }
@@ -0,0 +1,235 @@
+#include "Resample.h"
+
+#include "WaveFile.h"
+#include "log.h"
+#include "simd.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+namespace Resample
+{
+
+namespace
+{
+
+// Filter taps per output sample. A multiple of 8 for the dot product below.
+const unsigned TAPS = 64;
+const unsigned HALF = TAPS / 2;
+
+// Rates whose reduced ratio needs more phases than this (e.g. 44100 to 47999)
+// truncate each output position to the sub-sample offset at or before it, out
+// of MAX_PHASES evenly spaced ones.
+const uint64_t MAX_PHASES = 2048;
+
+// Passband edge relative to the lower of the two Nyquist frequencies, and the
+// Kaiser window shape: together about 100 dB of stopband rejection.
+const double CUTOFF = 0.95;
+const double KAISER_BETA = 9.0;
+
+const size_t CHUNK_FRAMES = 1 << 16;
+
+uint64_t gcd(uint64_t a, uint64_t b)
+{
+    while (b)
+    {
+        auto t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Zeroth order modified Bessel function of the first kind.
+double bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+    for (int k = 1; k < 50 && term > sum * 1e-12; ++k)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+double sinc(double x)
+{
+    return x == 0 ? 1 : std::sin(M_PI * x) / (M_PI * x);
+}
+
+float dot(float const *a, float const *b)
+{
+#if SIMD_SSE2
+    auto sum0 = _mm_setzero_ps();
+    auto sum1 = _mm_setzero_ps();
+    for (unsigned k = 0; k < TAPS; k += 8)
+    {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + k), _mm_loadu_ps(b + k)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + k + 4), _mm_loadu_ps(b + k + 4)));
+    }
+    auto sum = _mm_add_ps(sum0, sum1);
+    auto shuffled = _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 0, 1));
+    sum = _mm_add_ps(sum, shuffled);
+    sum = _mm_add_ss(sum, _mm_movehl_ps(shuffled, sum));
+    return _mm_cvtss_f32(sum);
+#elif SIMD_NEON
+    auto sum0 = vdupq_n_f32(0);
+    auto sum1 = vdupq_n_f32(0);
+    for (unsigned k = 0; k < TAPS; k += 8)
+    {
+        sum0 = vmlaq_f32(sum0, vld1q_f32(a + k), vld1q_f32(b + k));
+        sum1 = vmlaq_f32(sum1, vld1q_f32(a + k + 4), vld1q_f32(b + k + 4));
+    }
+    auto sum = vaddq_f32(sum0, sum1);
+    auto pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+    return vget_lane_f32(vpadd_f32(pair, pair), 0);
+#else
+    float sum = 0;
+    for (unsigned k = 0; k < TAPS; ++k)
+    {
+        sum += a[k] * b[k];
+    }
+    return sum;
+#endif
+}
+
+} // namespace
+
+Resampler::Resampler(unsigned from_rate, unsigned to_rate, unsigned channels)
+    : _channels(channels)
+    , _history(channels, std::vector<float>(HALF - 1, 0.0f))
+    , _first(-int64_t(HALF - 1))
+    , _input_frames(0)
+    , _output_frames(0)
+{
+    if (from_rate == 0 || to_rate == 0 || channels == 0)
+    {
+        THROW("Cannot resample %@ channels from %@ Hz to %@ Hz", channels, from_rate, to_rate);
+    }
+    auto divisor = gcd(from_rate, to_rate);
+    _up = to_rate / divisor;
+    _down = from_rate / divisor;
+    _phases = (unsigned)std::min(_up, MAX_PHASES);
+
+    // Row p holds the kernel sampled at p / _phases past each input sample,
+    // from the furthest ahead to the furthest behind, normalized so that
+    // every phase passes DC unchanged.
+    auto cutoff = std::min(1.0, to_rate / (double)from_rate) * CUTOFF;
+    auto window_scale = 1 / bessel_i0(KAISER_BETA);
+    _coefficients.resize(_phases * TAPS);
+    for (unsigned phase = 0; phase < _phases; ++phase)
+    {
+        auto row = &_coefficients[phase * TAPS];
+        double sum = 0;
+        for (unsigned k = 0; k < TAPS; ++k)
+        {
+            auto distance = phase / (double)_phases + HALF - 1 - k;
+            auto x = distance / HALF;
+            auto window = std::abs(x) < 1 ? bessel_i0(KAISER_BETA * std::sqrt(1 - x * x)) * window_scale : 0;
+            row[k] = float(cutoff * sinc(cutoff * distance) * window);
+            sum += row[k];
+        }
+        for (unsigned k = 0; k < TAPS; ++k)
+        {
+            row[k] = float(row[k] / sum);
+        }
+    }
+}
+
+void Resampler::process(float const *in, size_t frames, std::vector<float> &out)
+{
+    for (unsigned channel = 0; channel < _channels; ++channel)
+    {
+        auto &history = _history[channel];
+        auto size = history.size();
+        history.resize(size + frames);
+        for (size_t i = 0; i < frames; ++i)
+        {
+            history[size + i] = in[i * _channels + channel];
+        }
+    }
+    _input_frames += frames;
+    generate(out, UINT64_MAX);
+}
+
+void Resampler::flush(std::vector<float> &out)
+{
+    for (auto &history : _history)
+    {
+        history.resize(history.size() + HALF, 0.0f);
+    }
+    generate(out, (_input_frames * _up + _down - 1) / _down);
+}
+
+void Resampler::generate(std::vector<float> &out, uint64_t limit)
+{
+    auto available = _first + (int64_t)_history[0].size();
+    for (; _output_frames < limit; ++_output_frames)
+    {
+        auto position = _output_frames * _down;
+        auto index = (int64_t)(position / _up);
+        if (index + HALF >= available)
+        {
+            break;
+        }
+        auto phase = (position % _up) * _phases / _up;
+        auto row = &_coefficients[phase * TAPS];
+        auto offset = index - HALF + 1 - _first;
+        for (auto &history : _history)
+        {
+            out.push_back(dot(row, &history[offset]));
+        }
+    }
+
+    // Drop the input no later output frame reaches back to.
+    auto next = (int64_t)(_output_frames * _down / _up) - HALF + 1;
+    auto consumed = (size_t)std::max<int64_t>(0, std::min(next, available) - _first);
+    for (auto &history : _history)
+    {
+        history.erase(history.begin(), history.begin() + consumed);
+    }
+    _first += consumed;
+}
+
+void convert_file(std::string const &in, std::string const &out, unsigned rate)
+{
+    WaveFile::Reader reader(in);
+    auto channels = reader.info().channels;
+    Resampler resampler(reader.info().sample_rate, rate, channels);
+
+    auto temporary = out + ".part";
+    try
+    {
+        WaveFile::Writer writer(temporary, rate, channels);
+        std::vector<float> input(CHUNK_FRAMES * channels), output;
+        for (size_t frames; (frames = reader.read(input.data(), CHUNK_FRAMES)) != 0;)
+        {
+            output.clear();
+            resampler.process(input.data(), frames, output);
+            writer.write(output.data(), output.size() / channels);
+        }
+        output.clear();
+        resampler.flush(output);
+        writer.write(output.data(), output.size() / channels);
+        writer.finish();
+    }
+    catch (...)
+    {
+        ::unlink(temporary.c_str());
+        throw;
+    }
+    if (::rename(temporary.c_str(), out.c_str()) != 0)
+    {
+        auto error = errno;
+        ::unlink(temporary.c_str());
+        THROW("Cannot replace %@: %@", out, std::strerror(error));
+    }
+    logv("Resampled %@ from %@ Hz to %@ Hz into %@", in, reader.info().sample_rate, rate, out);
+}
+
+} // namespace Resample
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Resample
+{
+
+// Streaming polyphase windowed-sinc sample-rate converter for interleaved
+// float frames. Output lags input by half the filter length, so call flush()
+// after the last process() to get the tail.
+class Resampler
+{
+public:
+    Resampler(unsigned from_rate, unsigned to_rate, unsigned channels);
+
+    // Consumes `frames` input frames, appending every output frame that can
+    // be computed so far to out.
+    void process(float const *in, size_t frames, std::vector<float> &out);
+
+    // Appends the remaining output frames, for a total of
+    // ceil(input frames * to_rate / from_rate).
+    void flush(std::vector<float> &out);
+
+private:
+    void generate(std::vector<float> &out, uint64_t limit);
+
+    unsigned _channels;
+    uint64_t _up;   // output rate / gcd
+    uint64_t _down; // input rate / gcd
+    unsigned _phases;
+    std::vector<float> _coefficients; // _phases rows of TAPS, reversed for a forward dot product
+    std::vector<std::vector<float>> _history; // per channel, starting at input frame _first
+    int64_t _first;
+    uint64_t _input_frames;
+    uint64_t _output_frames;
+};
+
+// Resamples the wave file at `in` to `rate`, writing it to `out` as 32-bit
+// float. The output is written next to `out` and renamed over it once
+// complete, so `out` may be the input itself. Throws exception on failure.
+void convert_file(std::string const &in, std::string const &out, unsigned rate);
+
+} // namespace Resample
@@ -0,0 +1,155 @@
+#include "SampleIndex.h"
+
+#include "SampleLibrary.h"
+#include "files.h"
+#include "log.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace
+{
+
+// Path components, lowercase, split at either kind of slash.
+std::vector<std::string> split_path(std::string const &path)
+{
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (start <= path.size())
+    {
+        auto end = std::min(path.find_first_of("/\\", start), path.size());
+        if (end > start)
+        {
+            parts.push_back(fold(path.substr(start, end - start)));
+        }
+        start = end + 1;
+    }
+    return parts;
+}
+
+} // namespace
+
+void SampleIndex::add_root(std::string const &root, bool recursive)
+{
+    std::vector<std::string> pending{root};
+    while (!pending.empty())
+    {
+        auto directory = std::move(pending.back());
+        pending.pop_back();
+        auto dir = ::opendir(directory.c_str());
+        if (!dir)
+        {
+            logw("Cannot list %@: %@", directory, std::strerror(errno));
+            continue;
+        }
+        auto index = (uint32_t)_directories.size();
+        _directories.push_back(directory);
+        // d_type saves a stat() per entry on the file systems that fill it in.
+        while (auto entry = ::readdir(dir))
+        {
+            if (!std::strcmp(entry->d_name, ".") || !std::strcmp(entry->d_name, ".."))
+            {
+                continue;
+            }
+            auto type = entry->d_type;
+            if (type == DT_UNKNOWN || type == DT_LNK)
+            {
+                struct stat status;
+                auto path = directory + "/" + entry->d_name;
+                auto result = type == DT_LNK ? ::stat(path.c_str(), &status) : ::lstat(path.c_str(), &status);
+                if (result != 0)
+                {
+                    continue;
+                }
+                if (S_ISREG(status.st_mode))
+                {
+                    type = DT_REG;
+                }
+                else if (S_ISDIR(status.st_mode) && type == DT_UNKNOWN)
+                {
+                    type = DT_DIR;
+                }
+                else
+                {
+                    continue;
+                }
+            }
+            if (type == DT_REG)
+            {
+                _files[fold(entry->d_name)].push_back({index, entry->d_name});
+                ++_size;
+            }
+            else if (type == DT_DIR && recursive)
+            {
+                pending.push_back(directory + "/" + entry->d_name);
+            }
+        }
+        ::closedir(dir);
+    }
+}
+
+std::string SampleIndex::resolve(std::string const &wave_path) const
+{
+    auto parts = split_path(wave_path);
+    if (parts.empty())
+    {
+        return {};
+    }
+    std::vector<std::string> candidates;
+    find(parts, candidates);
+    if (candidates.size() <= 1)
+    {
+        return candidates.empty() ? std::string() : candidates.front();
+    }
+
+    size_t best = 0, best_score = 0;
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        // Both end in the file name; compare the directories before it.
+        auto candidate = split_path(candidates[i]);
+        size_t score = 0;
+        while (score + 1 < candidate.size() && score + 1 < parts.size() &&
+               candidate[candidate.size() - 2 - score] == parts[parts.size() - 2 - score])
+        {
+            ++score;
+        }
+        if (score > best_score)
+        {
+            best_score = score;
+            best = i;
+        }
+    }
+    return candidates[best];
+}
+
+void SampleIndex::find(std::vector<std::string> const &parts, std::vector<std::string> &out) const
+{
+    auto it = _files.find(parts.back());
+    if (it != _files.end())
+    {
+        for (auto &entry : it->second)
+        {
+            out.push_back(_directories[entry.directory] + "/" + entry.name);
+        }
+    }
+    if (_library)
+    {
+        for (auto &record : _library->find(parts.back()))
+        {
+            out.push_back(record.path);
+        }
+    }
+    if (_next)
+    {
+        _next->find(parts, out);
+    }
+}
+
+size_t SampleIndex::size() const
+{
+    return _size + (_library ? _library->size() : 0) + (_next ? _next->size() : 0);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class SampleLibrary;
+
+// The files under a set of search roots, listed once and looked up by name
+// regardless of case, since sessions made on Windows rarely match the case of
+// the samples on disk. One index serves any number of sessions.
+class SampleIndex
+{
+public:
+    // Lists the files in `root`, and in all of its subdirectories if
+    // recursive. Directories that cannot be read are skipped with a warning.
+    // Symbolic links to directories are not followed.
+    void add_root(std::string const &root, bool recursive);
+
+    // Also looks in a persistent library index, which must outlive this one.
+    // Its files rank after the ones listed here.
+    void add_library(SampleLibrary const &library)
+    {
+        _library = &library;
+    }
+
+    // Also looks in another index, e.g. one of shared roots kept for a whole
+    // batch, which must outlive this one. Its files rank after this one's.
+    void add_index(SampleIndex const &index)
+    {
+        _next = &index;
+    }
+
+    // The file that a session's (Windows) wave path refers to, or empty if no
+    // file has its name. Of several files with the name, the one whose parent
+    // directories match most of the path's wins, then the one listed first.
+    std::string resolve(std::string const &wave_path) const;
+
+    // Number of files listed, the library's included.
+    size_t size() const;
+
+private:
+    // Every file named like the last of `parts`, in rank order.
+    void find(std::vector<std::string> const &parts, std::vector<std::string> &out) const;
+
+    struct Entry
+    {
+        uint32_t directory; // index into _directories
+        std::string name;
+    };
+
+    std::vector<std::string> _directories;
+    std::unordered_map<std::string, std::vector<Entry>> _files; // by lowercase name
+    size_t _size = 0;
+    SampleLibrary const *_library = nullptr;
+    SampleIndex const *_next = nullptr;
+};
@@ -0,0 +1,696 @@
+#include "SampleLibrary.h"
+
+#include "files.h"
+#include "log.h"
+#include "parallel.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <unordered_map>
+
+namespace
+{
+
+// Layout of the index file: a header, then directories, files and hash slots,
+// then the strings they refer to. Every section starts 8-byte aligned, so the
+// mapping can be read in place.
+const char MAGIC[8] = {'S', 'E', 'S', 'L', 'I', 'B', '\0', '\0'};
+const uint32_t VERSION = 2;
+const uint32_t NO_PARENT = UINT32_MAX;
+
+struct IndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t directory_count;
+    uint64_t file_count;
+    uint64_t slot_count; // a power of two
+    uint64_t directories; // file offsets of the sections
+    uint64_t files;
+    uint64_t slots;
+    uint64_t strings;
+    uint64_t strings_size;
+};
+
+struct DirectoryEntry
+{
+    uint64_t path; // offset into the strings
+    uint32_t path_length;
+    uint32_t parent;
+    int64_t mtime;
+    uint64_t first_file;
+    uint64_t file_count;
+};
+
+struct FileEntry
+{
+    uint64_t name;
+    uint64_t folded; // lowercase name, what the slots are keyed by
+    uint32_t name_length;
+    uint32_t directory;
+    uint64_t size;
+    int64_t mtime;
+    uint64_t hash;
+    uint8_t valid;
+    uint8_t encoding;
+    uint16_t channels;
+    uint32_t sample_rate;
+    uint32_t bits_per_sample;
+    uint32_t block_align;
+    uint64_t frames;
+    uint64_t data_offset;
+    uint64_t data_size;
+    uint64_t format_offset;
+    uint32_t format_size;
+    uint32_t hashed; // 1 if `hash` is of the contents, 0 if they could not be read
+};
+
+// Slots hold file index + 1 by hash of the lowercase name, 0 when empty.
+using Slot = uint64_t;
+
+// Typed access to a mapped index.
+struct View
+{
+    uint8_t const *data;
+    size_t size;
+
+    IndexHeader const &header() const
+    {
+        return *reinterpret_cast<IndexHeader const *>(data);
+    }
+
+    DirectoryEntry const &directory(uint64_t i) const
+    {
+        return reinterpret_cast<DirectoryEntry const *>(data + header().directories)[i];
+    }
+
+    FileEntry const &file(uint64_t i) const
+    {
+        return reinterpret_cast<FileEntry const *>(data + header().files)[i];
+    }
+
+    Slot slot(uint64_t i) const
+    {
+        return reinterpret_cast<Slot const *>(data + header().slots)[i];
+    }
+
+    std::string string(uint64_t offset, uint64_t length) const
+    {
+        return std::string(reinterpret_cast<char const *>(data + header().strings + offset), length);
+    }
+};
+
+bool fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t limit)
+{
+    return offset % 8 == 0 && offset <= limit && count <= (limit - offset) / size;
+}
+
+// Whether every offset and index in the file stays in bounds, so that the
+// accessors above can be used without checks.
+bool is_valid(View const &view)
+{
+    if (view.size < sizeof(IndexHeader))
+    {
+        return false;
+    }
+    auto &header = view.header();
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION ||
+        !fits(header.directories, header.directory_count, sizeof(DirectoryEntry), view.size) ||
+        !fits(header.files, header.file_count, sizeof(FileEntry), view.size) ||
+        !fits(header.slots, header.slot_count, sizeof(Slot), view.size) ||
+        !fits(header.strings, header.strings_size, 1, view.size) ||
+        header.slot_count == 0 || (header.slot_count & (header.slot_count - 1)) != 0 ||
+        header.slot_count <= header.file_count)
+    {
+        return false;
+    }
+    auto in_strings = [&](uint64_t offset, uint64_t length)
+    {
+        return offset <= header.strings_size && length <= header.strings_size - offset;
+    };
+    for (uint32_t i = 0; i < header.directory_count; ++i)
+    {
+        auto &directory = view.directory(i);
+        if (!in_strings(directory.path, directory.path_length) ||
+            (directory.parent != NO_PARENT && directory.parent >= i) ||
+            directory.first_file > header.file_count || directory.file_count > header.file_count - directory.first_file)
+        {
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < header.file_count; ++i)
+    {
+        auto &file = view.file(i);
+        if (!in_strings(file.name, file.name_length) || !in_strings(file.folded, file.name_length) ||
+            file.directory >= header.directory_count)
+        {
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < header.slot_count; ++i)
+    {
+        if (view.slot(i) > header.file_count)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A library file as the update sees it.
+struct File
+{
+    std::string name;
+    uint64_t size;
+    int64_t mtime;
+    uint64_t hash;
+    bool hashed;
+    WaveFile::Info info;
+    bool stale; // to be hashed and probed
+};
+
+struct Directory
+{
+    std::string path;
+    uint32_t parent;
+    int64_t mtime;
+    std::vector<File> files;
+};
+
+File to_file(View const &view, FileEntry const &entry)
+{
+    File file{};
+    file.name = view.string(entry.name, entry.name_length);
+    file.size = entry.size;
+    file.mtime = entry.mtime;
+    file.hash = entry.hash;
+    file.hashed = entry.hashed != 0;
+    // Files that could not be read are tried again on every update.
+    file.stale = !file.hashed;
+    file.info.valid = entry.valid != 0;
+    file.info.encoding = (WaveFile::Encoding)entry.encoding;
+    file.info.sample_rate = entry.sample_rate;
+    file.info.channels = entry.channels;
+    file.info.bits_per_sample = entry.bits_per_sample;
+    file.info.block_align = entry.block_align;
+    file.info.frames = entry.frames;
+    file.info.file_size = entry.size;
+    file.info.data_offset = entry.data_offset;
+    file.info.data_size = entry.data_size;
+    file.info.format_offset = entry.format_offset;
+    file.info.format_size = entry.format_size;
+    return file;
+}
+
+// Holds an exclusive flock() on a lock file next to the index for as long as
+// it lives.
+class Lock
+{
+public:
+    explicit Lock(std::string const &path)
+    {
+        _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        if (_fd < 0)
+        {
+            THROW("Cannot open %@: %@", path, std::strerror(errno));
+        }
+        while (::flock(_fd, LOCK_EX) != 0)
+        {
+            if (errno != EINTR)
+            {
+                auto error = errno;
+                ::close(_fd);
+                THROW("Cannot lock %@: %@", path, std::strerror(error));
+            }
+        }
+    }
+
+    ~Lock()
+    {
+        ::close(_fd);
+    }
+
+    Lock(Lock const &) = delete;
+    Lock &operator=(Lock const &) = delete;
+
+private:
+    int _fd;
+};
+
+// Lists one directory that changed since the last update, keeping what the
+// old index knew of files that did not change.
+void list_directory(Directory &directory, std::unordered_map<std::string, File> &known,
+                    std::vector<std::string> &subdirectories)
+{
+    auto dir = ::opendir(directory.path.c_str());
+    if (!dir)
+    {
+        logw("Cannot list %@: %@", directory.path, std::strerror(errno));
+        return;
+    }
+    std::vector<std::string> names;
+    while (auto entry = ::readdir(dir))
+    {
+        if (std::strcmp(entry->d_name, ".") && std::strcmp(entry->d_name, ".."))
+        {
+            names.push_back(entry->d_name);
+        }
+    }
+    ::closedir(dir);
+    std::sort(names.begin(), names.end());
+
+    for (auto &name : names)
+    {
+        auto path = directory.path + "/" + name;
+        struct stat status;
+        if (::lstat(path.c_str(), &status) != 0)
+        {
+            continue;
+        }
+        // Links to files are indexed, links to directories are not followed.
+        if (S_ISLNK(status.st_mode) && (::stat(path.c_str(), &status) != 0 || !S_ISREG(status.st_mode)))
+        {
+            continue;
+        }
+        if (S_ISDIR(status.st_mode))
+        {
+            subdirectories.push_back(path);
+        }
+        else if (S_ISREG(status.st_mode))
+        {
+            auto it = known.find(name);
+            if (it != known.end() && it->second.size == (uint64_t)status.st_size &&
+                it->second.mtime == mtime_of(status))
+            {
+                directory.files.push_back(std::move(it->second));
+            }
+            else
+            {
+                File file{};
+                file.name = name;
+                file.size = (uint64_t)status.st_size;
+                file.mtime = mtime_of(status);
+                file.stale = true;
+                directory.files.push_back(std::move(file));
+            }
+        }
+    }
+}
+
+void write_index(std::string const &path, std::vector<Directory> const &directories)
+{
+    std::string strings;
+    auto add_string = [&](std::string const &text)
+    {
+        auto offset = strings.size();
+        strings += text;
+        return (uint64_t)offset;
+    };
+
+    IndexHeader header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.directory_count = (uint32_t)directories.size();
+    std::vector<DirectoryEntry> directory_entries;
+    std::vector<FileEntry> file_entries;
+    for (uint32_t i = 0; i < directories.size(); ++i)
+    {
+        auto &directory = directories[i];
+        DirectoryEntry entry{};
+        entry.path = add_string(directory.path);
+        entry.path_length = (uint32_t)directory.path.size();
+        entry.parent = directory.parent;
+        entry.mtime = directory.mtime;
+        entry.first_file = file_entries.size();
+        entry.file_count = directory.files.size();
+        directory_entries.push_back(entry);
+        for (auto &file : directory.files)
+        {
+            FileEntry out{};
+            out.name = add_string(file.name);
+            out.folded = add_string(fold(file.name));
+            out.name_length = (uint32_t)file.name.size();
+            out.directory = i;
+            out.size = file.size;
+            out.mtime = file.mtime;
+            out.hash = file.hash;
+            out.hashed = file.hashed;
+            out.valid = file.info.valid;
+            out.encoding = (uint8_t)file.info.encoding;
+            out.channels = (uint16_t)file.info.channels;
+            out.sample_rate = file.info.sample_rate;
+            out.bits_per_sample = file.info.bits_per_sample;
+            out.block_align = file.info.block_align;
+            out.frames = file.info.frames;
+            out.data_offset = file.info.data_offset;
+            out.data_size = file.info.data_size;
+            out.format_offset = file.info.format_offset;
+            out.format_size = file.info.format_size;
+            file_entries.push_back(out);
+        }
+    }
+    header.file_count = file_entries.size();
+
+    // At most half full, so that probe sequences stay short.
+    header.slot_count = 2;
+    while (header.slot_count < 2 * header.file_count)
+    {
+        header.slot_count *= 2;
+    }
+    std::vector<Slot> slots(header.slot_count);
+    for (uint64_t i = 0; i < file_entries.size(); ++i)
+    {
+        auto key = content_hash(strings.data() + file_entries[i].folded, file_entries[i].name_length);
+        auto slot = key & (header.slot_count - 1);
+        while (slots[slot])
+        {
+            slot = (slot + 1) & (header.slot_count - 1);
+        }
+        slots[slot] = i + 1;
+    }
+
+    header.directories = sizeof(IndexHeader);
+    header.files = header.directories + directory_entries.size() * sizeof(DirectoryEntry);
+    header.slots = header.files + file_entries.size() * sizeof(FileEntry);
+    header.strings = header.slots + slots.size() * sizeof(Slot);
+    header.strings_size = strings.size();
+
+    // Written beside the index and renamed over it, so that readers see
+    // either the old index or the new one.
+    auto temporary = path + ".tmp";
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    out.write(reinterpret_cast<char const *>(directory_entries.data()),
+              directory_entries.size() * sizeof(DirectoryEntry));
+    out.write(reinterpret_cast<char const *>(file_entries.data()), file_entries.size() * sizeof(FileEntry));
+    out.write(reinterpret_cast<char const *>(slots.data()), slots.size() * sizeof(Slot));
+    out.write(strings.data(), strings.size());
+    out.close();
+    if (out.fail())
+    {
+        ::unlink(temporary.c_str());
+        THROW("Cannot write %@", temporary);
+    }
+    if (::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        auto error = errno;
+        ::unlink(temporary.c_str());
+        THROW("Cannot replace %@: %@", path, std::strerror(error));
+    }
+}
+
+// Brings the index at `path` up to date with `roots` and maps it, all under
+// the lock.
+MappedFile update(std::string const &path, std::vector<std::string> const &roots, unsigned threads)
+{
+    Lock lock(path + ".lock");
+
+    std::unique_ptr<MappedFile> old;
+    View view{nullptr, 0};
+    if (::access(path.c_str(), F_OK) == 0)
+    {
+        try
+        {
+            old.reset(new MappedFile(path));
+            view = View{old->data(), old->size()};
+            if (!is_valid(view))
+            {
+                logw("Rebuilding %@: not a sample index of this version", path);
+                old.reset();
+            }
+        }
+        catch (std::exception const &e)
+        {
+            logw("Rebuilding %@: %@", path, e.what());
+            old.reset();
+        }
+        if (!old)
+        {
+            view = View{nullptr, 0};
+        }
+    }
+
+    std::unordered_map<std::string, uint32_t> old_directories;
+    std::vector<std::vector<uint32_t>> old_children;
+    if (old)
+    {
+        old_children.resize(view.header().directory_count);
+        for (uint32_t i = 0; i < view.header().directory_count; ++i)
+        {
+            auto &directory = view.directory(i);
+            old_directories.emplace(view.string(directory.path, directory.path_length), i);
+            if (directory.parent != NO_PARENT)
+            {
+                old_children[directory.parent].push_back(i);
+            }
+        }
+    }
+
+    // Depth first from each root in turn, which is also the order the old
+    // index was written in, so an unchanged tree comes out identical.
+    std::vector<Directory> directories;
+    bool changed = !old;
+    size_t reused = 0;
+    for (auto &root : roots)
+    {
+        std::vector<std::pair<std::string, uint32_t>> pending{{root, NO_PARENT}};
+        while (!pending.empty())
+        {
+            auto next = std::move(pending.back());
+            pending.pop_back();
+            struct stat status;
+            if (::stat(next.first.c_str(), &status) != 0)
+            {
+                logw("Cannot list %@: %@", next.first, std::strerror(errno));
+                continue;
+            }
+            if (!S_ISDIR(status.st_mode))
+            {
+                logw("Cannot list %@: not a directory", next.first);
+                continue;
+            }
+            Directory directory{next.first, next.second, mtime_of(status), {}};
+            auto index = (uint32_t)directories.size();
+            std::vector<std::string> subdirectories;
+            auto it = old_directories.find(directory.path);
+            if (it != old_directories.end() && view.directory(it->second).mtime == directory.mtime)
+            {
+                auto &entry = view.directory(it->second);
+                for (uint64_t i = 0; i < entry.file_count; ++i)
+                {
+                    directory.files.push_back(to_file(view, view.file(entry.first_file + i)));
+                }
+                for (auto child : old_children[it->second])
+                {
+                    auto &child_entry = view.directory(child);
+                    subdirectories.push_back(view.string(child_entry.path, child_entry.path_length));
+                }
+                ++reused;
+            }
+            else
+            {
+                std::unordered_map<std::string, File> known;
+                if (it != old_directories.end())
+                {
+                    auto &entry = view.directory(it->second);
+                    for (uint64_t i = 0; i < entry.file_count; ++i)
+                    {
+                        auto file = to_file(view, view.file(entry.first_file + i));
+                        auto name = file.name;
+                        known.emplace(std::move(name), std::move(file));
+                    }
+                }
+                list_directory(directory, known, subdirectories);
+                changed = true;
+            }
+            if (old && (index >= view.header().directory_count ||
+                        view.directory(index).parent != directory.parent ||
+                        view.string(view.directory(index).path, view.directory(index).path_length) != directory.path))
+            {
+                changed = true;
+            }
+            directories.push_back(std::move(directory));
+            for (auto child = subdirectories.rbegin(); child != subdirectories.rend(); ++child)
+            {
+                pending.push_back({std::move(*child), index});
+            }
+        }
+    }
+    if (old && directories.size() != view.header().directory_count)
+    {
+        changed = true;
+    }
+
+    std::vector<File *> stale;
+    std::vector<std::string> stale_paths;
+    for (auto &directory : directories)
+    {
+        for (auto &file : directory.files)
+        {
+            if (file.stale)
+            {
+                stale.push_back(&file);
+                stale_paths.push_back(directory.path + "/" + file.name);
+            }
+        }
+    }
+    parallel_for(stale.size(), [&](size_t i)
+    {
+        auto &file = *stale[i];
+        try
+        {
+            MappedFile contents(stale_paths[i]);
+            file.hash = content_hash(contents.data(), contents.size());
+            file.hashed = true;
+        }
+        catch (std::exception const &e)
+        {
+            logw("Cannot hash %@: %@", stale_paths[i], e.what());
+        }
+        file.info = WaveFile::probe(stale_paths[i]);
+        file.stale = false;
+    }, threads);
+    logi("Sample index %@: %@ directories, %@ listed again, %@ files hashed", path, directories.size(),
+         directories.size() - reused, stale.size());
+    // Also when only files that could not be read before now could.
+    changed = changed || std::any_of(stale.begin(), stale.end(), [](File const *file) { return file->hashed; });
+
+    if (changed)
+    {
+        old.reset();
+        write_index(path, directories);
+    }
+    return MappedFile(path);
+}
+
+} // namespace
+
+SampleLibrary::SampleLibrary(std::string const &path, std::vector<std::string> const &roots, unsigned threads)
+    : _file(update(path, roots, threads))
+{
+}
+
+std::vector<SampleLibrary::Record> SampleLibrary::find(std::string const &name) const
+{
+    View view{_file.data(), _file.size()};
+    auto &header = view.header();
+    auto folded = fold(name);
+    std::vector<uint64_t> files;
+    auto slot = content_hash(folded.data(), folded.size()) & (header.slot_count - 1);
+    for (Slot value; (value = view.slot(slot)) != 0; slot = (slot + 1) & (header.slot_count - 1))
+    {
+        auto &file = view.file(value - 1);
+        if (file.name_length == folded.size() &&
+            std::memcmp(_file.data() + header.strings + file.folded, folded.data(), folded.size()) == 0)
+        {
+            files.push_back(value - 1);
+        }
+    }
+    std::sort(files.begin(), files.end());
+    std::vector<Record> records;
+    for (auto file : files)
+    {
+        records.push_back(record(file));
+    }
+    return records;
+}
+
+bool SampleLibrary::lookup(std::string const &path, Record &out) const
+{
+    for (auto &candidate : find(path.substr(path.rfind('/') + 1)))
+    {
+        if (candidate.path == path)
+        {
+            out = std::move(candidate);
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t SampleLibrary::size() const
+{
+    return View{_file.data(), _file.size()}.header().file_count;
+}
+
+SampleLibrary::Record SampleLibrary::record(uint64_t index) const
+{
+    View view{_file.data(), _file.size()};
+    auto &entry = view.file(index);
+    auto &directory = view.directory(entry.directory);
+    auto file = to_file(view, entry);
+    return {view.string(directory.path, directory.path_length) + "/" + file.name, file.size, file.mtime, file.hash,
+            file.hashed, file.info};
+}
+
+bool is_current(SampleLibrary::Record const &record)
+{
+    struct stat status;
+    return ::stat(record.path.c_str(), &status) == 0 && (uint64_t)status.st_size == record.size &&
+           mtime_of(status) == record.mtime;
+}
+
+uint64_t content_hash(void const *data, size_t size)
+{
+    const uint64_t P1 = 11400714785074694791ULL;
+    const uint64_t P2 = 14029467366897019727ULL;
+    const uint64_t P3 = 1609587929392839161ULL;
+    const uint64_t P4 = 9650029242287828579ULL;
+    const uint64_t P5 = 2870177450012600261ULL;
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto step = [&](uint64_t acc, uint64_t input) { return rotl(acc + input * P2, 31) * P1; };
+    auto merge = [&](uint64_t acc, uint64_t value) { return (acc ^ step(0, value)) * P1 + P4; };
+    auto read64 = [](uint8_t const *p) { uint64_t v; std::memcpy(&v, p, 8); return v; };
+    auto read32 = [](uint8_t const *p) { uint32_t v; std::memcpy(&v, p, 4); return (uint64_t)v; };
+
+    auto p = static_cast<uint8_t const *>(data);
+    auto end = p + size;
+    uint64_t hash;
+    if (size >= 32)
+    {
+        uint64_t v1 = P1 + P2, v2 = P2, v3 = 0, v4 = 0 - P1;
+        for (; p + 32 <= end; p += 32)
+        {
+            v1 = step(v1, read64(p));
+            v2 = step(v2, read64(p + 8));
+            v3 = step(v3, read64(p + 16));
+            v4 = step(v4, read64(p + 24));
+        }
+        hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        hash = merge(merge(merge(merge(hash, v1), v2), v3), v4);
+    }
+    else
+    {
+        hash = P5;
+    }
+    hash += size;
+    for (; p + 8 <= end; p += 8)
+    {
+        hash = rotl(hash ^ step(0, read64(p)), 27) * P1 + P4;
+    }
+    if (p + 4 <= end)
+    {
+        hash = rotl(hash ^ (read32(p) * P1), 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+    {
+        hash = rotl(hash ^ (*p * P5), 11) * P1;
+    }
+    hash ^= hash >> 33;
+    hash *= P2;
+    hash ^= hash >> 29;
+    hash *= P3;
+    hash ^= hash >> 32;
+    return hash;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "MappedFile.h"
+#include "WaveFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// An index of shared sample roots kept in a file, so that a batch of runs
+// lists, hashes and probes each library file once instead of once per run.
+//
+// Opening brings the file up to date first: directories whose modification
+// time is unchanged are taken from it without being listed, and files whose
+// size and modification time are unchanged keep their hash and probe results.
+// Updates hold an exclusive flock() on "<path>.lock" and replace the file by
+// renaming, so concurrent workers never see a partial index, and each keeps
+// reading the version it mapped.
+//
+// Files rewritten in place do not change their directory's time, so callers
+// should check a record against the file before trusting it, see is_current().
+class SampleLibrary
+{
+public:
+    struct Record
+    {
+        std::string path;
+        uint64_t size;
+        int64_t mtime;  // nanoseconds since the epoch
+        uint64_t hash;  // of the whole file
+        bool hashed;    // false if the file could not be read, leaving `hash` meaningless
+        WaveFile::Info info;
+    };
+
+    // Throws exception if the index can neither be updated nor read. Roots
+    // that cannot be listed are skipped with a warning.
+    SampleLibrary(std::string const &path, std::vector<std::string> const &roots, unsigned threads = 0);
+
+    // Every file named `name`, regardless of case, in index order.
+    std::vector<Record> find(std::string const &name) const;
+
+    // The record of the file at `path`, as listed.
+    bool lookup(std::string const &path, Record &out) const;
+
+    // Number of files indexed.
+    size_t size() const;
+
+private:
+    Record record(uint64_t file) const;
+
+    MappedFile _file;
+};
+
+// Whether the file at record.path still has the record's size and time.
+bool is_current(SampleLibrary::Record const &record);
+
+// 64-bit xxHash of data.
+uint64_t content_hash(void const *data, size_t size);
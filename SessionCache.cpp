@@ -0,0 +1,181 @@
+#include "SessionCache.h"
+
+#include "files.h"
+#include "log.h"
+
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+namespace CoolEdit
+{
+
+namespace
+{
+
+// 64-bit FNV-1a, to tell apart sessions of the same name in one cache
+// directory.
+uint64_t path_hash(std::string const &path)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (auto c : path)
+    {
+        hash = (hash ^ (unsigned char)c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// The cache at `path` if it is a current cache of `status`, else null.
+std::unique_ptr<MappedFile> map_current(std::string const &path, struct stat const &status)
+{
+    struct stat cache_status;
+    if (::stat(path.c_str(), &cache_status) != 0)
+    {
+        return nullptr;
+    }
+    std::unique_ptr<MappedFile> file;
+    try
+    {
+        file.reset(new MappedFile(path));
+    }
+    catch (std::exception const &e)
+    {
+        logw("Rewriting %@: %@", path, e.what());
+        return nullptr;
+    }
+    if (!Columns::is_valid(file->data(), file->size()))
+    {
+        logw("Rewriting %@: not a session cache of this version", path);
+        return nullptr;
+    }
+    auto &header = *reinterpret_cast<Columns::ColumnsHeader const *>(file->data());
+    if (header.source_size != (uint64_t)status.st_size || header.source_mtime != mtime_of(status))
+    {
+        logv("Rewriting %@: the session changed", path);
+        return nullptr;
+    }
+    return file;
+}
+
+MappedFile open_cache(std::string const &source, std::string const &path, bool &reused)
+{
+    // Taken before loading, so that a session changing during the load makes
+    // the cache stale rather than current.
+    struct stat status;
+    if (::stat(source.c_str(), &status) != 0)
+    {
+        THROW("Cannot stat %@: %@", source, std::strerror(errno));
+    }
+    auto file = map_current(path, status);
+    reused = file != nullptr;
+    if (file)
+    {
+        return std::move(*file);
+    }
+    auto result = try_load_session(source);
+    if (!result.status.ok())
+    {
+        THROW("%@: %@", source, result.status.message());
+    }
+    Columns::write(result.session, path, (uint64_t)status.st_size, mtime_of(status));
+    MappedFile written(path);
+    if (!Columns::is_valid(written.data(), written.size()))
+    {
+        THROW("%@ was replaced while being written", path);
+    }
+    return written;
+}
+
+} // namespace
+
+SessionCache::SessionCache(std::string const &source, std::string const &cache_dir)
+    : _reused(false)
+    , _file(open_cache(source, path(source, cache_dir), _reused))
+{
+}
+
+std::string SessionCache::path(std::string const &source, std::string const &cache_dir)
+{
+    if (cache_dir.empty())
+    {
+        return source + ".columns";
+    }
+    char hash[17];
+    std::snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)path_hash(source));
+    return cache_dir + "/" + source.substr(source.rfind('/') + 1) + "." + hash + ".columns";
+}
+
+void SessionCache::check_element_size(Columns::Column column, size_t size) const
+{
+    if (header().columns[column].element_size != size)
+    {
+        THROW("Column %@ holds %@-byte values, not %@-byte ones", (unsigned)column,
+              header().columns[column].element_size, size);
+    }
+}
+
+Session SessionCache::session() const
+{
+    using namespace Columns;
+    auto &in = header();
+    Session session{};
+    session.sample_rate = in.sample_rate;
+    session.samples_in_session = in.samples_in_session;
+    session.bits_per_sample = in.bits_per_sample;
+    session.channels = in.channels;
+    session.master_volume = in.master_volume;
+    session.master_volume_right = in.master_volume_right;
+    session.filename = string(in.filename);
+    session.tempo = {in.beats_per_minute, in.beats_per_bar, in.ticks_per_beat};
+
+    auto left_volumes = column<double>(TRACK_LEFT_VOLUME);
+    auto right_volumes = column<double>(TRACK_RIGHT_VOLUME);
+    auto titles = column<StringRef>(TRACK_TITLE);
+    auto mutes = column<uint8_t>(TRACK_MUTE);
+    for (size_t i = 0; i < left_volumes.size; ++i)
+    {
+        session.tracks.push_back({left_volumes[i], right_volumes[i], string(titles[i]), mutes[i] != 0});
+    }
+
+    auto wave_ids = column<uint32_t>(WAVE_ID);
+    auto filenames = column<StringRef>(WAVE_FILENAME);
+    for (size_t i = 0; i < wave_ids.size; ++i)
+    {
+        session.waves.push_back({wave_ids[i], string(filenames[i])});
+    }
+
+    auto ids = column<uint32_t>(BLOCK_ID);
+    session.blocks.resize(ids.size);
+    auto fill = [&](Column c, unsigned Block::*field)
+    {
+        auto values = column<uint32_t>(c);
+        for (size_t i = 0; i < values.size; ++i)
+        {
+            session.blocks[i].*field = values[i];
+        }
+    };
+    fill(BLOCK_ID, &Block::id);
+    fill(BLOCK_OFFSET_SAMPLES, &Block::offset_samples);
+    fill(BLOCK_SIZE_SAMPLES, &Block::size_samples);
+    fill(BLOCK_WAVE_OFFSET_SAMPLES, &Block::wave_offset_samples);
+    fill(BLOCK_WAVE_ID, &Block::wave_id);
+    fill(BLOCK_TRACK, &Block::track);
+    fill(BLOCK_PARENT_GROUP, &Block::parent_group);
+    fill(BLOCK_PUNCH_GENERATION, &Block::punch_generation);
+    fill(BLOCK_PREVIOUS_PUNCH, &Block::previous_punch);
+    fill(BLOCK_NEXT_PUNCH, &Block::next_punch);
+    fill(BLOCK_ORIGINAL_INDEX, &Block::original_index);
+    auto block_left_volumes = column<double>(BLOCK_LEFT_VOLUME);
+    auto block_right_volumes = column<double>(BLOCK_RIGHT_VOLUME);
+    for (size_t i = 0; i < ids.size; ++i)
+    {
+        session.blocks[i].left_volume = block_left_volumes[i];
+        session.blocks[i].right_volume = block_right_volumes[i];
+    }
+    return session;
+}
+
+} // namespace CoolEdit
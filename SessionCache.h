@@ -0,0 +1,89 @@
+#pragma once
+
+#include "MappedFile.h"
+#include "SessionColumns.h"
+
+#include <cstddef>
+#include <string>
+
+namespace CoolEdit
+{
+
+// A session kept as a columns file (see SessionColumns.h) beside its .ses or
+// in a cache directory, and read in place from a mapping of it, so that tools
+// opening the same sessions again skip parsing them.
+//
+// The cache records the size and modification time of the .ses it was written
+// from, and is written again whenever either differs, or it is missing,
+// damaged or of another version. It is replaced by renaming, so readers keep
+// the version they mapped.
+class SessionCache
+{
+public:
+    // A column mapped in place.
+    template <typename T>
+    struct Array
+    {
+        T const *data;
+        size_t size;
+
+        T const *begin() const
+        {
+            return data;
+        }
+
+        T const *end() const
+        {
+            return data + size;
+        }
+
+        T const &operator[](size_t i) const
+        {
+            return data[i];
+        }
+    };
+
+    // Maps the cache of the session at `source`, writing it first if it is
+    // not current. An empty `cache_dir` keeps it beside the session. Throws
+    // exception if the session cannot be loaded or the cache written.
+    explicit SessionCache(std::string const &source, std::string const &cache_dir = "");
+
+    // Where the cache of the session at `source` is kept.
+    static std::string path(std::string const &source, std::string const &cache_dir);
+
+    // Whether the cache was current, so the session was not parsed.
+    bool reused() const
+    {
+        return _reused;
+    }
+
+    Columns::ColumnsHeader const &header() const
+    {
+        return *reinterpret_cast<Columns::ColumnsHeader const *>(_file.data());
+    }
+
+    // Throws exception if T is not the size of the column's values.
+    template <typename T>
+    Array<T> column(Columns::Column column) const
+    {
+        auto &entry = header().columns[column];
+        check_element_size(column, sizeof(T));
+        return {reinterpret_cast<T const *>(_file.data() + entry.offset), (size_t)entry.count};
+    }
+
+    std::string string(Columns::StringRef const &ref) const
+    {
+        return std::string(column<char>(Columns::STRINGS).data + ref.offset, ref.length);
+    }
+
+    // A copy of the whole session, for code that takes one.
+    Session session() const;
+
+private:
+    void check_element_size(Columns::Column column, size_t size) const;
+
+    bool _reused;
+    MappedFile _file;
+};
+
+} // namespace CoolEdit
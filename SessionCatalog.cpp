@@ -0,0 +1,392 @@
+#include "SessionCatalog.h"
+
+#include "ColumnFile.h"
+#include "files.h"
+#include "log.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+using namespace CoolEdit;
+using ColumnFile::StringRef;
+using ColumnFile::Type;
+
+namespace
+{
+
+// The catalog is a column file (see ColumnFile.h) with a CatalogHeader and the
+// columns in Column order. Columns of sessions have one value per session;
+// FIRST_TRACK and FIRST_REFERENCE have one more, the end of the last
+// session's tracks and samples.
+const char MAGIC[8] = {'S', 'E', 'S', 'C', 'A', 'T', '\0', '\0'};
+const uint32_t VERSION = 2;
+const uint32_t PROBED = 1;
+
+enum Column
+{
+    PATH,                // StringRef per session
+    ERROR,               // StringRef per session, empty if it was read
+    FILENAME,            // StringRef per session
+    SAMPLE_RATE,         // uint32_t per session
+    SAMPLES_IN_SESSION,  // uint64_t per session
+    BITS_PER_SAMPLE,     // uint32_t per session
+    CHANNELS,            // uint32_t per session
+    MASTER_VOLUME,       // double per session
+    MASTER_VOLUME_RIGHT, // double per session
+    BEATS_PER_MINUTE,    // double per session
+    BEATS_PER_BAR,       // uint32_t per session
+    TICKS_PER_BEAT,      // uint32_t per session
+    FIRST_TRACK,         // uint64_t per session, + 1
+    FIRST_REFERENCE,     // uint64_t per session, + 1
+    TRACK_TITLE,         // StringRef per track
+    REFERENCE,           // uint32_t sample per reference, ascending per session
+    SAMPLE_NAME,         // StringRef per sample, sorted
+    FIRST_USER,          // uint64_t per sample, + 1
+    USER,                // uint32_t session per reference, ascending per sample
+    STRINGS,             // char
+    COLUMN_COUNT
+};
+
+struct CatalogHeader
+{
+    ColumnFile::Prefix prefix;
+    uint32_t flags;
+    uint32_t unused;
+    uint64_t session_count;
+    uint64_t track_count;
+    uint64_t reference_count;
+    uint64_t sample_count;
+    ColumnFile::ColumnEntry columns[COLUMN_COUNT];
+};
+
+const std::vector<Type> TYPES = {
+    Type::string, Type::string, Type::string, Type::uint32, Type::uint64, Type::uint32, Type::uint32,
+    Type::float64, Type::float64, Type::float64, Type::uint32, Type::uint32, Type::uint64, Type::uint64,
+    Type::string, Type::uint32, Type::string, Type::uint64, Type::uint32, Type::bytes,
+};
+
+// The lowercase file name of a (Windows) wave path.
+std::string sample_name(std::string const &path)
+{
+    auto slash = path.find_last_of("\\/");
+    return fold(slash == std::string::npos ? path : path.substr(slash + 1));
+}
+
+// Typed access to a mapped catalog.
+struct View
+{
+    uint8_t const *data;
+    size_t size;
+
+    CatalogHeader const &header() const
+    {
+        return *reinterpret_cast<CatalogHeader const *>(data);
+    }
+
+    template <typename T>
+    T const *column(Column column) const
+    {
+        return reinterpret_cast<T const *>(data + header().columns[column].offset);
+    }
+
+    std::string string(StringRef const &ref) const
+    {
+        return std::string(column<char>(STRINGS) + ref.offset, ref.length);
+    }
+};
+
+// Whether every column has the length the counts call for and every offset
+// and index stays in bounds, so that View can be used without checks.
+bool is_valid(View const &view)
+{
+    if (!ColumnFile::is_valid(view.data, view.size, sizeof(CatalogHeader), MAGIC, VERSION, TYPES))
+    {
+        return false;
+    }
+    auto &header = view.header();
+    for (int i = 0; i < COLUMN_COUNT; ++i)
+    {
+        uint64_t expected;
+        switch (i)
+        {
+        case FIRST_TRACK:
+        case FIRST_REFERENCE:
+            expected = header.session_count + 1;
+            break;
+        case TRACK_TITLE:
+            expected = header.track_count;
+            break;
+        case REFERENCE:
+        case USER:
+            expected = header.reference_count;
+            break;
+        case SAMPLE_NAME:
+            expected = header.sample_count;
+            break;
+        case FIRST_USER:
+            expected = header.sample_count + 1;
+            break;
+        case STRINGS:
+            expected = header.columns[STRINGS].count;
+            break;
+        default:
+            expected = header.session_count;
+            break;
+        }
+        if (header.columns[i].count != expected)
+        {
+            return false;
+        }
+    }
+    // Runs of a flat column, which must start at 0 and end at its length.
+    auto is_ascending = [&](Column column, uint64_t count, uint64_t end)
+    {
+        auto firsts = view.column<uint64_t>(column);
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            if (firsts[i] > firsts[i + 1])
+            {
+                return false;
+            }
+        }
+        return firsts[0] == 0 && firsts[count] == end;
+    };
+    auto is_below = [&](Column column, uint64_t count, uint64_t limit)
+    {
+        auto values = view.column<uint32_t>(column);
+        return std::all_of(values, values + count, [&](uint32_t value) { return value < limit; });
+    };
+    return is_ascending(FIRST_TRACK, header.session_count, header.track_count) &&
+           is_ascending(FIRST_REFERENCE, header.session_count, header.reference_count) &&
+           is_ascending(FIRST_USER, header.sample_count, header.reference_count) &&
+           is_below(REFERENCE, header.reference_count, header.sample_count) &&
+           is_below(USER, header.reference_count, header.session_count);
+}
+
+SessionCatalog::Entry read_session(std::string const &path, LoadOptions const &options, bool probe)
+{
+    SessionCatalog::Entry entry{};
+    entry.path = path;
+    if (probe)
+    {
+        auto result = probe_session(path, options);
+        entry.header = std::move(result.header);
+        if (!result.status.ok())
+        {
+            entry.error = result.status.message();
+        }
+        return entry;
+    }
+    auto result = try_load_session(path, options);
+    if (!result.status.ok())
+    {
+        entry.error = result.status.message();
+        return entry;
+    }
+    entry.header = get_header(result.session);
+    for (auto &track : result.session.tracks)
+    {
+        entry.tracks.push_back(track.title);
+    }
+    for (auto &wave : result.session.waves)
+    {
+        entry.samples.push_back(sample_name(wave.filename));
+    }
+    std::sort(entry.samples.begin(), entry.samples.end());
+    entry.samples.erase(std::unique(entry.samples.begin(), entry.samples.end()), entry.samples.end());
+    return entry;
+}
+
+void write_catalog(std::string const &path, std::vector<SessionCatalog::Entry> const &entries, bool probe)
+{
+    std::string strings;
+    auto add_string = [&](std::string const &text)
+    {
+        StringRef ref{strings.size(), text.size()};
+        strings += text;
+        return ref;
+    };
+
+    // Sample names in order, with the sessions using each.
+    std::map<std::string, std::vector<uint32_t>> samples;
+    for (uint32_t i = 0; i < entries.size(); ++i)
+    {
+        for (auto &name : entries[i].samples)
+        {
+            samples[name].push_back(i);
+        }
+    }
+    std::map<std::string, uint32_t> sample_ids;
+    std::vector<StringRef> sample_names;
+    std::vector<uint64_t> first_users{0};
+    std::vector<uint32_t> users;
+    for (auto &sample : samples)
+    {
+        sample_ids.emplace(sample.first, (uint32_t)sample_ids.size());
+        sample_names.push_back(add_string(sample.first));
+        users.insert(users.end(), sample.second.begin(), sample.second.end());
+        first_users.push_back(users.size());
+    }
+
+    auto count = entries.size();
+    std::vector<StringRef> paths(count), errors(count), filenames(count), titles;
+    std::vector<uint32_t> sample_rates(count), bits_per_sample(count), channels(count), beats_per_bar(count),
+        ticks_per_beat(count), references;
+    std::vector<uint64_t> samples_in_session(count), first_tracks{0}, first_references{0};
+    std::vector<double> master_volumes(count), master_volumes_right(count), beats_per_minute(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto &entry = entries[i];
+        auto &header = entry.header;
+        paths[i] = add_string(entry.path);
+        errors[i] = add_string(entry.error);
+        filenames[i] = add_string(header.filename);
+        sample_rates[i] = header.sample_rate;
+        samples_in_session[i] = header.samples_in_session;
+        bits_per_sample[i] = header.bits_per_sample;
+        channels[i] = header.channels;
+        master_volumes[i] = header.master_volume;
+        master_volumes_right[i] = header.master_volume_right;
+        beats_per_minute[i] = header.tempo.beats_per_minute;
+        beats_per_bar[i] = header.tempo.beats_per_bar;
+        ticks_per_beat[i] = header.tempo.ticks_per_beat;
+        for (auto &title : entry.tracks)
+        {
+            titles.push_back(add_string(title));
+        }
+        first_tracks.push_back(titles.size());
+        for (auto &name : entry.samples)
+        {
+            references.push_back(sample_ids[name]);
+        }
+        first_references.push_back(references.size());
+    }
+
+    std::vector<ColumnFile::Data> columns(COLUMN_COUNT);
+    columns[PATH] = {TYPES[PATH], paths.data(), paths.size()};
+    columns[ERROR] = {TYPES[ERROR], errors.data(), errors.size()};
+    columns[FILENAME] = {TYPES[FILENAME], filenames.data(), filenames.size()};
+    columns[SAMPLE_RATE] = {TYPES[SAMPLE_RATE], sample_rates.data(), sample_rates.size()};
+    columns[SAMPLES_IN_SESSION] = {TYPES[SAMPLES_IN_SESSION], samples_in_session.data(), samples_in_session.size()};
+    columns[BITS_PER_SAMPLE] = {TYPES[BITS_PER_SAMPLE], bits_per_sample.data(), bits_per_sample.size()};
+    columns[CHANNELS] = {TYPES[CHANNELS], channels.data(), channels.size()};
+    columns[MASTER_VOLUME] = {TYPES[MASTER_VOLUME], master_volumes.data(), master_volumes.size()};
+    columns[MASTER_VOLUME_RIGHT] = {TYPES[MASTER_VOLUME_RIGHT], master_volumes_right.data(),
+                                    master_volumes_right.size()};
+    columns[BEATS_PER_MINUTE] = {TYPES[BEATS_PER_MINUTE], beats_per_minute.data(), beats_per_minute.size()};
+    columns[BEATS_PER_BAR] = {TYPES[BEATS_PER_BAR], beats_per_bar.data(), beats_per_bar.size()};
+    columns[TICKS_PER_BEAT] = {TYPES[TICKS_PER_BEAT], ticks_per_beat.data(), ticks_per_beat.size()};
+    columns[FIRST_TRACK] = {TYPES[FIRST_TRACK], first_tracks.data(), first_tracks.size()};
+    columns[FIRST_REFERENCE] = {TYPES[FIRST_REFERENCE], first_references.data(), first_references.size()};
+    columns[TRACK_TITLE] = {TYPES[TRACK_TITLE], titles.data(), titles.size()};
+    columns[REFERENCE] = {TYPES[REFERENCE], references.data(), references.size()};
+    columns[SAMPLE_NAME] = {TYPES[SAMPLE_NAME], sample_names.data(), sample_names.size()};
+    columns[FIRST_USER] = {TYPES[FIRST_USER], first_users.data(), first_users.size()};
+    columns[USER] = {TYPES[USER], users.data(), users.size()};
+    columns[STRINGS] = {TYPES[STRINGS], strings.data(), strings.size()};
+
+    CatalogHeader header{};
+    std::memcpy(header.prefix.magic, MAGIC, sizeof(MAGIC));
+    header.prefix.version = VERSION;
+    header.flags = probe ? PROBED : 0;
+    header.session_count = count;
+    header.track_count = titles.size();
+    header.reference_count = references.size();
+    header.sample_count = sample_names.size();
+    ColumnFile::write(path, header, columns);
+}
+
+} // namespace
+
+void SessionCatalog::build(std::string const &path, std::vector<std::string> paths, LoadOptions options,
+                           bool probe, unsigned threads)
+{
+    std::sort(paths.begin(), paths.end());
+    paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+    std::vector<Entry> entries(paths.size());
+    parallel_for(paths.size(), [&](size_t i)
+    {
+        entries[i] = read_session(paths[i], options, probe);
+    }, threads);
+    auto failed = std::count_if(entries.begin(), entries.end(), [](Entry const &entry)
+    {
+        return !entry.error.empty();
+    });
+    write_catalog(path, entries, probe);
+    logi("Catalog %@: %@ sessions, %@ unreadable", path, entries.size(), failed);
+}
+
+SessionCatalog::SessionCatalog(std::string const &path)
+    : _file(path)
+{
+    if (!is_valid(View{_file.data(), _file.size()}))
+    {
+        THROW("%@ is not a session catalog of this version", path);
+    }
+}
+
+size_t SessionCatalog::size() const
+{
+    return View{_file.data(), _file.size()}.header().session_count;
+}
+
+bool SessionCatalog::probed() const
+{
+    return (View{_file.data(), _file.size()}.header().flags & PROBED) != 0;
+}
+
+SessionCatalog::Entry SessionCatalog::session(size_t index) const
+{
+    View view{_file.data(), _file.size()};
+    Entry entry{};
+    entry.path = view.string(view.column<StringRef>(PATH)[index]);
+    entry.error = view.string(view.column<StringRef>(ERROR)[index]);
+    auto &header = entry.header;
+    header.filename = view.string(view.column<StringRef>(FILENAME)[index]);
+    header.sample_rate = view.column<uint32_t>(SAMPLE_RATE)[index];
+    header.samples_in_session = view.column<uint64_t>(SAMPLES_IN_SESSION)[index];
+    header.bits_per_sample = view.column<uint32_t>(BITS_PER_SAMPLE)[index];
+    header.channels = view.column<uint32_t>(CHANNELS)[index];
+    header.master_volume = view.column<double>(MASTER_VOLUME)[index];
+    header.master_volume_right = view.column<double>(MASTER_VOLUME_RIGHT)[index];
+    header.tempo.beats_per_minute = view.column<double>(BEATS_PER_MINUTE)[index];
+    header.tempo.beats_per_bar = view.column<uint32_t>(BEATS_PER_BAR)[index];
+    header.tempo.ticks_per_beat = view.column<uint32_t>(TICKS_PER_BEAT)[index];
+    auto first_tracks = view.column<uint64_t>(FIRST_TRACK);
+    for (auto i = first_tracks[index]; i < first_tracks[index + 1]; ++i)
+    {
+        entry.tracks.push_back(view.string(view.column<StringRef>(TRACK_TITLE)[i]));
+    }
+    auto first_references = view.column<uint64_t>(FIRST_REFERENCE);
+    for (auto i = first_references[index]; i < first_references[index + 1]; ++i)
+    {
+        auto sample = view.column<uint32_t>(REFERENCE)[i];
+        entry.samples.push_back(view.string(view.column<StringRef>(SAMPLE_NAME)[sample]));
+    }
+    return entry;
+}
+
+std::vector<size_t> SessionCatalog::sessions_using(std::string const &name) const
+{
+    View view{_file.data(), _file.size()};
+    auto folded = sample_name(name);
+    auto names = view.column<StringRef>(SAMPLE_NAME);
+    auto count = view.header().sample_count;
+    auto strings = view.column<char>(STRINGS);
+    auto it = std::lower_bound(names, names + count, folded, [&](StringRef const &ref, std::string const &key)
+    {
+        return key.compare(0, key.size(), strings + ref.offset, ref.length) > 0;
+    });
+    std::vector<size_t> sessions;
+    if (it == names + count || view.string(*it) != folded)
+    {
+        return sessions;
+    }
+    auto sample = it - names;
+    auto first_users = view.column<uint64_t>(FIRST_USER);
+    auto users = view.column<uint32_t>(USER);
+    sessions.assign(users + first_users[sample], users + first_users[sample + 1]);
+    return sessions;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "MappedFile.h"
+#include "SessionFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A catalog of many sessions kept in one file, so that questions about an
+// archive, such as which sessions use a take, are answered without parsing it
+// again.
+//
+// Sessions are stored sorted by path, one fixed-width column per field, with
+// their track titles and sample names in flat columns beside them. Sample
+// names, lowercase and without directories, are sorted with the sessions that
+// use each, so lookups are a binary search of the mapped file.
+class SessionCatalog
+{
+public:
+    struct Entry
+    {
+        std::string path;
+        std::string error; // why the session could not be read, empty if it was
+        CoolEdit::SessionHeader header;
+        std::vector<std::string> tracks;  // titles
+        std::vector<std::string> samples; // lowercase wave file names, sorted
+    };
+
+    // Reads every session in `paths` in parallel and writes their catalog to
+    // `path`, replacing it by renaming. With `probe` only the headers are
+    // read, leaving tracks and samples out. Throws exception if the catalog
+    // cannot be written; sessions that cannot be read are kept with their
+    // error.
+    static void build(std::string const &path, std::vector<std::string> paths, CoolEdit::LoadOptions options,
+                      bool probe, unsigned threads = 0);
+
+    // Throws exception if `path` is not a catalog of this version.
+    explicit SessionCatalog(std::string const &path);
+
+    // Number of sessions.
+    size_t size() const;
+
+    Entry session(size_t index) const;
+
+    // The sessions using a sample named `name`, regardless of case and of the
+    // directories in front of it, in path order.
+    std::vector<size_t> sessions_using(std::string const &name) const;
+
+    // Whether the catalog was built with `probe`.
+    bool probed() const;
+
+private:
+    MappedFile _file;
+};
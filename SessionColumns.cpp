@@ -0,0 +1,156 @@
+#include "SessionColumns.h"
+
+#include <cstring>
+#include <vector>
+
+namespace CoolEdit
+{
+namespace Columns
+{
+
+namespace
+{
+
+const std::vector<Type> TYPES = {
+    Type::float64, Type::float64, Type::string, Type::uint8,                                  // tracks
+    Type::uint32, Type::string,                                                               // waves
+    Type::uint32, Type::float64, Type::float64, Type::uint32, Type::uint32, Type::uint32,     // blocks
+    Type::uint32, Type::uint32, Type::uint32, Type::uint32, Type::uint32, Type::uint32, Type::uint32,
+    Type::bytes,
+};
+
+// A column being built, as the bytes it will be written with.
+struct Builder
+{
+    Type type;
+    std::vector<char> bytes;
+
+    template <typename T>
+    void push(T value)
+    {
+        auto size = bytes.size();
+        bytes.resize(size + sizeof(T));
+        std::memcpy(bytes.data() + size, &value, sizeof(T));
+    }
+};
+
+// One column per field of each table, filled a table at a time.
+template <typename Row, typename T>
+void fill(Builder &column, Type type, std::vector<Row> const &rows, T Row::*field)
+{
+    column.type = type;
+    column.bytes.resize(rows.size() * sizeof(T));
+    auto out = column.bytes.data();
+    for (auto &row : rows)
+    {
+        std::memcpy(out, &(row.*field), sizeof(T));
+        out += sizeof(T);
+    }
+}
+
+StringRef add_string(std::string &strings, std::string const &text)
+{
+    StringRef ref{strings.size(), text.size()};
+    strings += text;
+    return ref;
+}
+
+template <typename Row>
+void fill_strings(Builder &column, std::vector<Row> const &rows, std::string Row::*field, std::string &strings)
+{
+    column.type = Type::string;
+    for (auto &row : rows)
+    {
+        column.push(add_string(strings, row.*field));
+    }
+}
+
+} // namespace
+
+void write(Session const &session, std::string const &path, uint64_t source_size, int64_t source_mtime)
+{
+    Builder columns[COLUMN_COUNT];
+    std::string strings;
+
+    fill(columns[TRACK_LEFT_VOLUME], Type::float64, session.tracks, &Track::left_volume);
+    fill(columns[TRACK_RIGHT_VOLUME], Type::float64, session.tracks, &Track::right_volume);
+    fill_strings(columns[TRACK_TITLE], session.tracks, &Track::title, strings);
+    columns[TRACK_MUTE].type = Type::uint8;
+    for (auto &track : session.tracks)
+    {
+        columns[TRACK_MUTE].push((uint8_t)track.mute);
+    }
+    fill(columns[WAVE_ID], Type::uint32, session.waves, &Wave::id);
+    fill_strings(columns[WAVE_FILENAME], session.waves, &Wave::filename, strings);
+    fill(columns[BLOCK_ID], Type::uint32, session.blocks, &Block::id);
+    fill(columns[BLOCK_LEFT_VOLUME], Type::float64, session.blocks, &Block::left_volume);
+    fill(columns[BLOCK_RIGHT_VOLUME], Type::float64, session.blocks, &Block::right_volume);
+    fill(columns[BLOCK_OFFSET_SAMPLES], Type::uint32, session.blocks, &Block::offset_samples);
+    fill(columns[BLOCK_SIZE_SAMPLES], Type::uint32, session.blocks, &Block::size_samples);
+    fill(columns[BLOCK_WAVE_OFFSET_SAMPLES], Type::uint32, session.blocks, &Block::wave_offset_samples);
+    fill(columns[BLOCK_WAVE_ID], Type::uint32, session.blocks, &Block::wave_id);
+    fill(columns[BLOCK_TRACK], Type::uint32, session.blocks, &Block::track);
+    fill(columns[BLOCK_PARENT_GROUP], Type::uint32, session.blocks, &Block::parent_group);
+    fill(columns[BLOCK_PUNCH_GENERATION], Type::uint32, session.blocks, &Block::punch_generation);
+    fill(columns[BLOCK_PREVIOUS_PUNCH], Type::uint32, session.blocks, &Block::previous_punch);
+    fill(columns[BLOCK_NEXT_PUNCH], Type::uint32, session.blocks, &Block::next_punch);
+    fill(columns[BLOCK_ORIGINAL_INDEX], Type::uint32, session.blocks, &Block::original_index);
+
+    ColumnsHeader header{};
+    std::memcpy(header.prefix.magic, MAGIC, sizeof(MAGIC));
+    header.prefix.version = VERSION;
+    header.sample_rate = session.sample_rate;
+    header.bits_per_sample = session.bits_per_sample;
+    header.channels = session.channels;
+    header.beats_per_bar = session.tempo.beats_per_bar;
+    header.samples_in_session = session.samples_in_session;
+    header.master_volume = session.master_volume;
+    header.master_volume_right = session.master_volume_right;
+    header.beats_per_minute = session.tempo.beats_per_minute;
+    header.ticks_per_beat = session.tempo.ticks_per_beat;
+    header.source_size = source_size;
+    header.source_mtime = source_mtime;
+    header.filename = add_string(strings, session.filename);
+
+    // Last, once every string is in.
+    columns[STRINGS].type = Type::bytes;
+    columns[STRINGS].bytes.assign(strings.begin(), strings.end());
+
+    std::vector<ColumnFile::Data> data;
+    for (auto &column : columns)
+    {
+        auto count = column.bytes.size() / ColumnFile::element_size(column.type);
+        data.push_back({column.type, column.bytes.data(), count});
+    }
+    ColumnFile::write(path, header, data);
+}
+
+bool is_valid(void const *data, size_t size)
+{
+    if (!ColumnFile::is_valid(data, size, sizeof(ColumnsHeader), MAGIC, VERSION, TYPES))
+    {
+        return false;
+    }
+    auto &header = *static_cast<ColumnsHeader const *>(data);
+    auto strings_size = header.columns[STRINGS].count;
+    if (header.filename.offset > strings_size || header.filename.length > strings_size - header.filename.offset)
+    {
+        return false;
+    }
+    // Tables have as many rows in every column.
+    const Column FIRSTS[] = {TRACK_LEFT_VOLUME, WAVE_ID, BLOCK_ID, STRINGS};
+    for (size_t table = 0; table + 1 < sizeof(FIRSTS) / sizeof(FIRSTS[0]); ++table)
+    {
+        for (auto i = FIRSTS[table]; i < FIRSTS[table + 1]; i = (Column)(i + 1))
+        {
+            if (header.columns[i].count != header.columns[FIRSTS[table]].count)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace Columns
+} // namespace CoolEdit
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "ColumnFile.h"
+#include "SessionFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace CoolEdit
+{
+
+// A session as typed column arrays, for analytics tools that map many of them
+// instead of parsing sessions or JSON.
+//
+// The file is a column file (see ColumnFile.h) with a ColumnsHeader and the
+// columns in Column order. Columns of one table have one value per row, e.g.
+// BLOCK_TRACK[i] is the track of block i.
+namespace Columns
+{
+
+using ColumnFile::ColumnEntry;
+using ColumnFile::StringRef;
+using ColumnFile::Type;
+
+const char MAGIC[8] = {'S', 'E', 'S', 'C', 'O', 'L', '\0', '\0'};
+const uint32_t VERSION = 3;
+
+enum Column : uint32_t
+{
+    TRACK_LEFT_VOLUME,         // float64 per track
+    TRACK_RIGHT_VOLUME,        // float64
+    TRACK_TITLE,               // string
+    TRACK_MUTE,                // uint8, 0 or 1
+    WAVE_ID,                   // uint32 per wave
+    WAVE_FILENAME,             // string
+    BLOCK_ID,                  // uint32 per block
+    BLOCK_LEFT_VOLUME,         // float64
+    BLOCK_RIGHT_VOLUME,        // float64
+    BLOCK_OFFSET_SAMPLES,      // uint32
+    BLOCK_SIZE_SAMPLES,        // uint32
+    BLOCK_WAVE_OFFSET_SAMPLES, // uint32
+    BLOCK_WAVE_ID,             // uint32
+    BLOCK_TRACK,               // uint32
+    BLOCK_PARENT_GROUP,        // uint32
+    BLOCK_PUNCH_GENERATION,    // uint32
+    BLOCK_PREVIOUS_PUNCH,      // uint32
+    BLOCK_NEXT_PUNCH,          // uint32
+    BLOCK_ORIGINAL_INDEX,      // uint32
+    STRINGS,                   // bytes
+    COLUMN_COUNT
+};
+
+struct ColumnsHeader
+{
+    ColumnFile::Prefix prefix;
+    uint32_t sample_rate;
+    uint32_t bits_per_sample;
+    uint32_t channels;
+    uint32_t beats_per_bar;
+    uint64_t samples_in_session;
+    double master_volume;
+    double master_volume_right;
+    double beats_per_minute;
+    uint32_t ticks_per_beat;
+    uint32_t unused;
+    uint64_t source_size; // of the .ses the session was read from, 0 if not known
+    int64_t source_mtime; // nanoseconds since the epoch, 0 if not known
+    StringRef filename;
+    ColumnEntry columns[COLUMN_COUNT];
+};
+
+// Writes `session` to `path`, replacing it by renaming. Throws exception if
+// the file cannot be written.
+void write(Session const &session, std::string const &path, uint64_t source_size = 0, int64_t source_mtime = 0);
+
+// Whether `data` is a columns file of this version whose columns, types and
+// strings all stay in bounds, so that it can be read without checks.
+bool is_valid(void const *data, size_t size);
+
+} // namespace Columns
+
+} // namespace CoolEdit
@@ -1,21 +1,18 @@
 #include "SessionFile.h"
 
 #include "log.h"
+#include "simd.h"
 
 #include "json.hpp"
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <fstream>
 
 namespace CoolEdit
 {
 
-#if LOG
-auto &logger = std::cerr;
-#else
-std::ofstream logger;
-#endif
-
 using BYTE = uint8_t;
 using WORD = uint16_t;
 using SIGNED_WORD = int16_t;
@@ -26,36 +23,94 @@ using DOUBLE = double;
 template <typename T>
 bool read(T &out, std::istream &in)
 {
-    uint8_t *bytes = reinterpret_cast<uint8_t *>(&out);
-    for (size_t i = 0; i < sizeof(T); ++i)
-    {
-        if (!in.good())
-        {
-            return false;
-        }
-        bytes[i] = in.get();
-    }
-    return true;
+    in.read(reinterpret_cast<char *>(&out), sizeof(T));
+    return in.gcount() == sizeof(T);
+}
+
+constexpr DWORD tag(const char (&name)[5])
+{
+    return DWORD(BYTE(name[0])) | DWORD(BYTE(name[1])) << 8 | DWORD(BYTE(name[2])) << 16 | DWORD(BYTE(name[3])) << 24;
+}
+
+struct Tag
+{
+    DWORD value;
+};
+
+void format_value(fmt::Buffer &out, Tag const &tag)
+{
+    out.append(reinterpret_cast<const char *>(&tag.value), sizeof(tag.value));
+}
+
+// Which chunks a parse reads. The others are skipped by their length.
+enum class Scope
+{
+    all,
+    header,    // hdr and tmpo, see probe_session
+    structure, // hdr, FILE and its wav entries, and blk, see try_load_structure
+};
+
+// State shared by the chunk readers, so that failures can report where they
+// happened without building any message.
+struct Parser
+{
+    std::istream &in;
+    Session &session;
+    LoadLimits const &limits;
+    uint64_t end;
+    DWORD tag;
+    uint64_t offset;
+    uint64_t allocated;
+    unsigned depth;
+    Scope scope;
+    bool have_header;
+    bool have_tempo;
+};
+
+LoadStatus failure(Parser const &parser, LoadError error, const char *detail, uint64_t expected = 0, uint64_t actual = 0)
+{
+    LoadStatus status{};
+    status.error = error;
+    std::memcpy(status.tag, &parser.tag, sizeof(status.tag));
+    status.offset = parser.offset;
+    status.detail = detail;
+    status.expected = expected;
+    status.actual = actual;
+    return status;
 }
 
-#define PUT(os, object, property) \
-    format(os, #property ": %@\n", object.property)
+#define PUT(out, object, property) \
+    FORMAT_TO(out, #property ": %@\n", object.property)
+
+#define CHECKED_READ(PARSER, OUT)                                                        \
+    if (!read(OUT, PARSER.in))                                                           \
+    {                                                                                    \
+        return failure(PARSER, LoadError::read_failed, "failed to read value '" #OUT "'"); \
+    }
+
+#define EXPECT_EQ(PARSER, ERROR, A, B)                                                               \
+    {                                                                                                \
+        const auto &a(A);                                                                            \
+        const auto &b(B);                                                                            \
+        if (a != b)                                                                                  \
+        {                                                                                            \
+            return failure(PARSER, ERROR, "expected " #A " == " #B, (uint64_t)a, (uint64_t)b);       \
+        }                                                                                            \
+    }
 
-#define CHECKED_READ(OUT, IN)                               \
-    if (!read(OUT, IN))                                     \
-    {                                                       \
-        throw exception("failed to read value '" #OUT "'"); \
+#define CHECK_LIMIT(PARSER, VALUE, LIMIT)                                                             \
+    if ((uint64_t)(VALUE) > (uint64_t)(LIMIT))                                                         \
+    {                                                                                              \
+        return failure(PARSER, LoadError::limit_exceeded, #VALUE " > " #LIMIT, (LIMIT), (VALUE));  \
     }
 
-#define EXPECT_EQ(A, B)                                                                                        \
-    {                                                                                                          \
-        const auto &a(A);                                                                                      \
-        const auto &b(B);                                                                                      \
-        if (a != b)                                                                                            \
-        {                                                                                                      \
-            loge("Verification failed: expected " #A " == " #B ", got %@ and %@", a, b);            \
-            throw exception("Verification failed: expected " #A " == " #B ", got %@ and %@", a, b); \
-        }                                                                                                      \
+#define CHECK(STATUS)                \
+    {                                \
+        auto status_ = (STATUS);     \
+        if (!status_.ok())           \
+        {                            \
+            return status_;          \
+        }                            \
     }
 
 #define PACKED_STRUCT struct __attribute__((packed))
@@ -76,22 +131,21 @@ PACKED_STRUCT Header
     BYTE unknown[44];
 };
 
-std::ostream &operator<<(std::ostream &os, Header const &header)
-{
-    PUT(os, header, sample_rate);
-    PUT(os, header, samples_in_session);
-    PUT(os, header, number_of_wave_blocks);
-    PUT(os, header, bits_per_sample);
-    PUT(os, header, channels);
-    PUT(os, header, master_volume);
-    PUT(os, header, master_volume_right);
-    PUT(os, header, session_time_offset_samples);
-    PUT(os, header, save_associated_files_separately);
-    PUT(os, header, priv);
-    PUT(os, header, filename);
-    PUT(os, header, unknown);
-    return os;
-};
+void format_value(fmt::Buffer &out, Header const &header)
+{
+    PUT(out, header, sample_rate);
+    PUT(out, header, samples_in_session);
+    PUT(out, header, number_of_wave_blocks);
+    PUT(out, header, bits_per_sample);
+    PUT(out, header, channels);
+    PUT(out, header, master_volume);
+    PUT(out, header, master_volume_right);
+    PUT(out, header, session_time_offset_samples);
+    PUT(out, header, save_associated_files_separately);
+    PUT(out, header, priv);
+    PUT(out, header, filename);
+    PUT(out, header, unknown);
+}
 
 PACKED_STRUCT TempoBlock
 {
@@ -102,15 +156,14 @@ PACKED_STRUCT TempoBlock
     DOUBLE unknown;
 };
 
-std::ostream &operator<<(std::ostream &os, TempoBlock const &tempo)
+void format_value(fmt::Buffer &out, TempoBlock const &tempo)
 {
-    PUT(os, tempo, beats_per_minute);
-    PUT(os, tempo, beats_per_bar);
-    PUT(os, tempo, ticks_per_beat);
-    PUT(os, tempo, beat_offset_ms);
-    PUT(os, tempo, unknown);
-    return os;
-};
+    PUT(out, tempo, beats_per_minute);
+    PUT(out, tempo, beats_per_bar);
+    PUT(out, tempo, ticks_per_beat);
+    PUT(out, tempo, beat_offset_ms);
+    PUT(out, tempo, unknown);
+}
 
 PACKED_STRUCT TrackBlock
 {
@@ -121,14 +174,13 @@ PACKED_STRUCT TrackBlock
     char unknown[40];
 };
 
-std::ostream &operator<<(std::ostream &os, TrackBlock const &block)
+void format_value(fmt::Buffer &out, TrackBlock const &block)
 {
-    PUT(os, block, left_volume);
-    PUT(os, block, right_volume);
-    PUT(os, block, flags);
-    PUT(os, block, title);
-    PUT(os, block, unknown);
-    return os;
+    PUT(out, block, left_volume);
+    PUT(out, block, right_volume);
+    PUT(out, block, flags);
+    PUT(out, block, title);
+    PUT(out, block, unknown);
 }
 
 PACKED_STRUCT WaveBlockBlock
@@ -153,27 +205,26 @@ PACKED_STRUCT WaveBlockBlock
     DWORD unknown;
 };
 
-std::ostream &operator<<(std::ostream &os, WaveBlockBlock const &block)
-{
-    PUT(os, block, left_volume);
-    PUT(os, block, right_volume);
-    PUT(os, block, unused1);
-    PUT(os, block, unused2);
-    PUT(os, block, offset_samples);
-    PUT(os, block, size_samples);
-    PUT(os, block, id);
-    PUT(os, block, flags);
-    PUT(os, block, wave_id);
-    PUT(os, block, track_id);
-    PUT(os, block, parent_group);
-    PUT(os, block, unused);
-    PUT(os, block, wave_offset);
-    PUT(os, block, punch_generation);
-    PUT(os, block, previous_punch);
-    PUT(os, block, next_punch);
-    PUT(os, block, original_index);
-    PUT(os, block, unknown);
-    return os;
+void format_value(fmt::Buffer &out, WaveBlockBlock const &block)
+{
+    PUT(out, block, left_volume);
+    PUT(out, block, right_volume);
+    PUT(out, block, unused1);
+    PUT(out, block, unused2);
+    PUT(out, block, offset_samples);
+    PUT(out, block, size_samples);
+    PUT(out, block, id);
+    PUT(out, block, flags);
+    PUT(out, block, wave_id);
+    PUT(out, block, track_id);
+    PUT(out, block, parent_group);
+    PUT(out, block, unused);
+    PUT(out, block, wave_offset);
+    PUT(out, block, punch_generation);
+    PUT(out, block, previous_punch);
+    PUT(out, block, next_punch);
+    PUT(out, block, original_index);
+    PUT(out, block, unknown);
 }
 
 struct WaveListEntryBlock
@@ -184,40 +235,59 @@ struct WaveListEntryBlock
     DWORD unused[2];
 };
 
-std::ostream &operator<<(std::ostream &os, WaveListEntryBlock const &block)
+void format_value(fmt::Buffer &out, WaveListEntryBlock const &block)
 {
-    PUT(os, block, id);
-    PUT(os, block, nineteen);
-    PUT(os, block, filename);
-    PUT(os, block, unused);
-    return os;
+    PUT(out, block, id);
+    PUT(out, block, nineteen);
+    PUT(out, block, filename);
+    PUT(out, block, unused);
 }
 
-std::string read_block_header(std::istream &in)
+// Accounts for memory the parsed session is about to take.
+LoadStatus charge(Parser &parser, uint64_t bytes)
 {
-    char header[4];
-    CHECKED_READ(header, in);
-    return {header, 4};
+    parser.allocated += bytes;
+    CHECK_LIMIT(parser, parser.allocated, parser.limits.max_allocation);
+    return {};
 }
 
-bool read(WaveListEntryBlock &block, std::istream &in, size_t length)
+// Checks that count records of the given size fit in what is left of the
+// chunk, before anything is reserved for them.
+LoadStatus check_count(Parser &parser, DWORD count, size_t record_size, uint64_t chunk_end)
 {
-    read(block.id, in);
-    read(block.nineteen, in);
-    length -= sizeof(DWORD) * 4 + 1;
-    block.filename.resize(length);
-    in.read(&block.filename[0], length);
-    in.get();
-    read(block.unused, in);
-    return true;
+    auto available = chunk_end - std::min<uint64_t>(chunk_end, (uint64_t)parser.in.tellg());
+    if (count * uint64_t(record_size) > available)
+    {
+        return failure(parser, LoadError::invalid_length, "record count exceeds chunk length",
+                       available / record_size, count);
+    }
+    return {};
 }
 
-Header read_header(std::istream &in)
+LoadStatus read(Parser &parser, WaveListEntryBlock &block, DWORD length)
 {
-    Header header{};
-    CHECKED_READ(header, in);
-    logger << header << '\n';
-    return header;
+    auto &in = parser.in;
+    const DWORD FIXED = sizeof(DWORD) * 4 + 1; // id, nineteen, unused, NUL
+    if (length < FIXED)
+    {
+        return failure(parser, LoadError::invalid_length, "wave list entry shorter than its fixed fields",
+                       FIXED, length);
+    }
+    auto filename_length = length - FIXED;
+    CHECK_LIMIT(parser, filename_length, parser.limits.max_string_length);
+    CHECK(charge(parser, sizeof(Wave) + filename_length));
+
+    CHECKED_READ(parser, block.id);
+    CHECKED_READ(parser, block.nineteen);
+    block.filename.resize(filename_length);
+    in.read(&block.filename[0], filename_length);
+    if ((DWORD)in.gcount() != filename_length)
+    {
+        return failure(parser, LoadError::read_failed, "failed to read value 'block.filename'");
+    }
+    in.get();
+    CHECKED_READ(parser, block.unused);
+    return {};
 }
 
 std::string get_clean_string(const char *s, size_t count)
@@ -227,83 +297,141 @@ std::string get_clean_string(const char *s, size_t count)
     return string;
 }
 
-std::string read_block(Session &session, std::istream &in)
+// Whether a parse of `scope` reads the chunks tagged `header`.
+bool reads(Scope scope, DWORD header)
+{
+    switch (scope)
+    {
+    case Scope::header:
+        return header == tag("hdr ") || header == tag("tmpo");
+    case Scope::structure:
+        return header == tag("hdr ") || header == tag("FILE") || header == tag("wav ") || header == tag("blk ");
+    case Scope::all:
+        break;
+    }
+    return true;
+}
+
+LoadStatus read_block(Parser &parser, DWORD &header)
 {
-    auto header = read_block_header(in);
-    logger << "Block header: " << header << '\n';
-    
-    if (header == "LIST")
+    auto &in = parser.in;
+    auto &session = parser.session;
+    parser.offset = (uint64_t)in.tellg();
+    parser.tag = 0;
+
+    CHECKED_READ(parser, header);
+    parser.tag = header;
+    logv("Block header: %@", Tag{header});
+
+    if (header == tag("LIST"))
     {
-        header = read_block_header(in);
-        logger << "Block header 2: " << header << '\n';
-        EXPECT_EQ("FILE", header);
+        CHECKED_READ(parser, header);
+        parser.tag = header;
+        logv("Block header 2: %@", Tag{header});
+        EXPECT_EQ(parser, LoadError::unexpected_chunk, tag("FILE"), header);
     }
 
     DWORD length{};
-    read(length, in);
-    logger << "Block length: " << length << '\n';
+    CHECKED_READ(parser, length);
+    logv("Block length: %@", length);
 
-    auto previous_tellg = (int)in.tellg();
+    auto previous_tellg = (uint64_t)in.tellg();
 
-    if (header == "hdr ")
+    if (!reads(parser.scope, header))
+    {
+        if (previous_tellg + length > parser.end)
+        {
+            return failure(parser, LoadError::chunk_length_mismatch, "chunk extends past the end of the file",
+                           parser.end, previous_tellg + length);
+        }
+        in.seekg(length, std::ios::cur);
+    }
+    else if (header == tag("hdr "))
     {
-        auto block = read_header(in);
+        Header block{};
+        CHECKED_READ(parser, block);
+        logv("\n%@", block);
         session.sample_rate = block.sample_rate;
+        session.samples_in_session = block.samples_in_session;
+        session.bits_per_sample = block.bits_per_sample;
+        session.channels = block.channels;
         session.master_volume = block.master_volume;
+        session.master_volume_right = block.master_volume_right;
         session.filename = get_clean_string(block.filename, sizeof(block.filename));
+        parser.have_header = true;
     }
-    else if (header == "tmpo")
+    else if (header == tag("tmpo"))
     {
         TempoBlock tempo{};
-        CHECKED_READ(tempo, in);
-        logger << tempo << '\n';
+        CHECKED_READ(parser, tempo);
+        logv("\n%@", tempo);
         session.tempo.beats_per_minute = tempo.beats_per_minute;
         session.tempo.beats_per_bar = (unsigned)tempo.beats_per_bar;
         session.tempo.ticks_per_beat = (unsigned)tempo.ticks_per_beat;
+        parser.have_tempo = true;
     }
-    else if (header == "trks")
+    else if (header == tag("trks"))
     {
         DWORD count{};
-        read(count, in);
-        logger << "Track count: " << count << '\n';
-        for (auto i = 0; i < count; ++i)
+        CHECKED_READ(parser, count);
+        logv("Track count: %@", count);
+        CHECK(check_count(parser, count, sizeof(TrackBlock), previous_tellg + length));
+        CHECK_LIMIT(parser, session.tracks.size() + count, parser.limits.max_records);
+        CHECK(charge(parser, count * uint64_t(sizeof(Track))));
+        session.tracks.reserve(session.tracks.size() + count);
+        for (DWORD i = 0; i < count; ++i)
         {
             TrackBlock block;
-            CHECKED_READ(block, in);
-            logger << block << '\n';
+            CHECKED_READ(parser, block);
+            logv("\n%@", block);
             Track track{};
             track.left_volume = block.left_volume;
             track.right_volume = block.right_volume;
             track.title = get_clean_string(block.title, sizeof(block.title));
+            CHECK(charge(parser, track.title.size()));
             track.mute = block.flags & 1;
             session.tracks.push_back(std::move(track));
         }
     }
-    else if (header == "FILE")
+    else if (header == tag("FILE"))
     {
-        while (read_block(session, in) == "wav ");
-        return header;
+        CHECK_LIMIT(parser, parser.depth + 1, parser.limits.max_depth);
+        ++parser.depth;
+        DWORD child{};
+        LoadStatus status{};
+        do
+        {
+            status = read_block(parser, child);
+        } while (status.ok() && child == tag("wav ") && (uint64_t)in.tellg() != parser.end);
+        // Also on failure, as a salvaging load carries on after it.
+        --parser.depth;
+        return status;
     }
-    else if (header == "wav ")
+    else if (header == tag("wav "))
     {
+        CHECK_LIMIT(parser, session.waves.size() + 1, parser.limits.max_records);
         WaveListEntryBlock block;
-        read(block, in, length);
-        logger << block << '\n';
+        CHECK(read(parser, block, length));
+        logv("\n%@", block);
         Wave wave{};
         wave.id = block.id;
         wave.filename = block.filename;
         session.waves.push_back(std::move(wave));
     }
-    else if (header == "blk ")
+    else if (header == tag("blk "))
     {
         DWORD count{};
-        read(count, in);
-        logger << "Block count: " << count << '\n';
-        for (auto i = 0; i < count; ++i)
+        CHECKED_READ(parser, count);
+        logv("Block count: %@", count);
+        CHECK(check_count(parser, count, sizeof(WaveBlockBlock), previous_tellg + length));
+        CHECK_LIMIT(parser, session.blocks.size() + count, parser.limits.max_records);
+        CHECK(charge(parser, count * uint64_t(sizeof(Block))));
+        session.blocks.reserve(session.blocks.size() + count);
+        for (DWORD i = 0; i < count; ++i)
         {
             WaveBlockBlock block;
-            CHECKED_READ(block, in);
-            logger << block << '\n';
+            CHECKED_READ(parser, block);
+            logv("\n%@", block);
             Block wave;
             wave.id = block.id;
             wave.left_volume = block.left_volume;
@@ -313,49 +441,309 @@ std::string read_block(Session &session, std::istream &in)
             wave.size_samples = block.size_samples;
             wave.wave_id = block.wave_id;
             wave.track = block.track_id;
+            wave.parent_group = block.parent_group;
+            wave.punch_generation = block.punch_generation;
+            wave.previous_punch = block.previous_punch;
+            wave.next_punch = block.next_punch;
+            wave.original_index = block.original_index;
             session.blocks.push_back(std::move(wave));
         }
     }
     else
     {
+        if (previous_tellg + length > parser.end)
+        {
+            return failure(parser, LoadError::chunk_length_mismatch, "chunk extends past the end of the file",
+                           parser.end, previous_tellg + length);
+        }
         in.seekg(length, std::ios::cur);
     }
-    EXPECT_EQ(previous_tellg + length, (int)in.tellg());
-    return header;
+    EXPECT_EQ(parser, LoadError::chunk_length_mismatch, previous_tellg + length, (uint64_t)in.tellg());
+    return {};
 }
 
 const uint64_t COOLNESS = 0x5353454e4c4f4f43;
 
-Session load_session(std::string const &path)
+// Chunks a salvage scan can resume from.
+const DWORD KNOWN_TAGS[] = {tag("hdr "), tag("tmpo"), tag("trks"), tag("LIST"), tag("wav "), tag("blk ")};
+
+bool is_known_tag(const char *p)
 {
+    DWORD value;
+    std::memcpy(&value, p, sizeof(value));
+    for (auto known : KNOWN_TAGS)
+    {
+        if (value == known)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns the first position i such that a known tag fits in [i, i + 4) of
+// data, or size if there is none. Candidates are found sixteen bytes at a
+// time by matching the tags' first characters.
+size_t find_known_tag(const char *data, size_t size)
+{
+    size_t i = 0;
+#if SIMD_SSE2
+    const __m128i h = _mm_set1_epi8('h');
+    const __m128i t = _mm_set1_epi8('t');
+    const __m128i L = _mm_set1_epi8('L');
+    const __m128i w = _mm_set1_epi8('w');
+    const __m128i b = _mm_set1_epi8('b');
+    for (; i + 16 + 3 <= size; i += 16)
+    {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        auto hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, h), _mm_cmpeq_epi8(v, t)),
+                                 _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, L), _mm_cmpeq_epi8(v, w)),
+                                              _mm_cmpeq_epi8(v, b)));
+        for (unsigned mask = _mm_movemask_epi8(hits); mask; mask &= mask - 1)
+        {
+            auto candidate = i + __builtin_ctz(mask);
+            if (is_known_tag(data + candidate))
+            {
+                return candidate;
+            }
+        }
+    }
+#elif SIMD_NEON
+    const uint8x16_t h = vdupq_n_u8('h');
+    const uint8x16_t t = vdupq_n_u8('t');
+    const uint8x16_t L = vdupq_n_u8('L');
+    const uint8x16_t w = vdupq_n_u8('w');
+    const uint8x16_t b = vdupq_n_u8('b');
+    for (; i + 16 + 3 <= size; i += 16)
+    {
+        auto v = vld1q_u8(reinterpret_cast<const uint8_t *>(data + i));
+        auto hits = vorrq_u8(vorrq_u8(vceqq_u8(v, h), vceqq_u8(v, t)),
+                             vorrq_u8(vorrq_u8(vceqq_u8(v, L), vceqq_u8(v, w)), vceqq_u8(v, b)));
+        auto nibbles = simd_nibble_mask(hits);
+        while (nibbles)
+        {
+            auto index = __builtin_ctzll(nibbles) / 4;
+            if (is_known_tag(data + i + index))
+            {
+                return i + index;
+            }
+            nibbles &= ~(0xfull << (index * 4));
+        }
+    }
+#endif
+    for (; i + 4 <= size; ++i)
+    {
+        if (is_known_tag(data + i))
+        {
+            return i;
+        }
+    }
+    return size;
+}
+
+// A tag only counts if the length after it fits in the rest of the file.
+bool is_plausible_chunk(const char *p, size_t available, uint64_t remaining)
+{
+    DWORD length;
+    if (std::memcmp(p, "LIST", 4) == 0)
+    {
+        if (available < 12 || std::memcmp(p + 4, "FILE", 4) != 0)
+        {
+            return false;
+        }
+        std::memcpy(&length, p + 8, sizeof(length));
+        return length + uint64_t(12) <= remaining;
+    }
+    if (available < 8)
+    {
+        return false;
+    }
+    std::memcpy(&length, p + 4, sizeof(length));
+    return length + uint64_t(8) <= remaining;
+}
+
+// Returns the offset of the first plausible chunk at or after from, or the
+// end of the file.
+uint64_t resynchronize(Parser &parser, uint64_t from)
+{
+    const size_t WINDOW = 1 << 20;
+    const size_t LOOKAHEAD = 12; // "LIST" "FILE" length
+    std::vector<char> buffer(WINDOW);
+    auto &in = parser.in;
+    for (auto offset = from; offset < parser.end;)
+    {
+        in.clear();
+        in.seekg(offset);
+        in.read(buffer.data(), std::min<uint64_t>(WINDOW, parser.end - offset));
+        size_t size = in.gcount();
+        auto last = offset + size == parser.end;
+        if (size == 0)
+        {
+            break;
+        }
+        // Candidates too close to the window's end are picked up by the next
+        // window, which overlaps this one.
+        auto scan = last ? size : size - (LOOKAHEAD - 4);
+        for (size_t position = 0; position < scan;)
+        {
+            position += find_known_tag(buffer.data() + position, scan - position);
+            if (position >= scan)
+            {
+                break;
+            }
+            if (is_plausible_chunk(buffer.data() + position, size - position, parser.end - offset - position))
+            {
+                return offset + position;
+            }
+            ++position;
+        }
+        if (last || size <= LOOKAHEAD)
+        {
+            break;
+        }
+        offset += size - (LOOKAHEAD - 1);
+    }
+    return parser.end;
+}
+
+LoadResult parse_session(std::string const &path, LoadOptions const &options, Scope scope)
+{
+    LoadResult result{};
     std::ifstream file(path, std::ios::binary | std::ios::in | std::ios::ate);
+    Parser parser{file, result.session, options.limits, 0, 0, 0, 0, 0, scope, false, false};
 
     if (!file.good())
     {
-        throw exception("failed to load file: %@", path);
+        result.status = failure(parser, LoadError::open_failed, nullptr);
+        return result;
     }
-    
-    DWORD actual_file_length = static_cast<DWORD>(file.tellg());
+
+    parser.end = (uint64_t)file.tellg();
     file.seekg(0);
 
-    Session session{};
-    
-    uint64_t coolness{};
-    read(coolness, file);
-    EXPECT_EQ(COOLNESS, coolness); // COOLNESS
+    auto parse = [&]() -> LoadStatus {
+        uint64_t coolness{};
+        CHECKED_READ(parser, coolness);
+        EXPECT_EQ(parser, LoadError::bad_signature, COOLNESS, coolness); // COOLNESS
 
-    DWORD length{};
-    read(length, file);
-    logger << "File length: " << length << '\n';
-    
-    EXPECT_EQ(actual_file_length, length + 8 + 4); // COOLNESS + length
+        DWORD length{};
+        CHECKED_READ(parser, length);
+        logv("File length: %@", length);
+
+        if (options.salvage && parser.end != length + uint64_t(8 + 4))
+        {
+            // Typically a truncated file; parse whatever is there.
+            result.skipped.push_back({parser.end, 0, failure(parser, LoadError::file_length_mismatch,
+                                                             "expected parser.end == length + 8 + 4",
+                                                             parser.end, length + uint64_t(8 + 4))});
+        }
+        else
+        {
+            EXPECT_EQ(parser, LoadError::file_length_mismatch, parser.end, length + 8 + 4); // COOLNESS + length
+        }
+
+        while ((uint64_t)file.tellg() != parser.end &&
+               !(scope == Scope::header && parser.have_header && parser.have_tempo))
+        {
+            DWORD header{};
+            auto status = read_block(parser, header);
+            if (status.ok())
+            {
+                continue;
+            }
+            if (!options.salvage)
+            {
+                return status;
+            }
+            auto resume = resynchronize(parser, status.offset + 1);
+            result.skipped.push_back({status.offset, resume - status.offset, status});
+            file.clear();
+            file.seekg(resume);
+        }
+        return {};
+    };
+    result.status = parse();
+    return result;
+}
+
+LoadResult try_load_session(std::string const &path, LoadOptions const &options)
+{
+    return parse_session(path, options, Scope::all);
+}
+
+LoadResult try_load_structure(std::string const &path, LoadOptions const &options)
+{
+    return parse_session(path, options, Scope::structure);
+}
+
+SessionHeader get_header(Session const &session)
+{
+    SessionHeader header{};
+    header.sample_rate = session.sample_rate;
+    header.samples_in_session = session.samples_in_session;
+    header.bits_per_sample = session.bits_per_sample;
+    header.channels = session.channels;
+    header.master_volume = session.master_volume;
+    header.master_volume_right = session.master_volume_right;
+    header.filename = session.filename;
+    header.tempo = session.tempo;
+    return header;
+}
+
+ProbeResult probe_session(std::string const &path, LoadOptions const &options)
+{
+    auto result = parse_session(path, options, Scope::header);
+    return {get_header(result.session), result.status};
+}
 
-    while (file.tellg() != actual_file_length)
+Session load_session(std::string const &path)
+{
+    auto result = try_load_session(path);
+    if (!result.status.ok())
     {
-        read_block(session, file);
+        THROW("%@: %@", path, result.status.message());
     }
+    return std::move(result.session);
+}
 
-    return session;
+std::string LoadStatus::message() const
+{
+    static const char *const DESCRIPTIONS[] = {
+        "no error",
+        "cannot open file",
+        "unexpected end of data",
+        "not a Cool Edit session",
+        "file length does not match header",
+        "unexpected chunk",
+        "chunk length does not match contents",
+        "invalid length",
+        "resource limit exceeded",
+    };
+    fmt::StackBuffer<256> out;
+    FORMAT_TO(out, "%@", DESCRIPTIONS[(int)error]);
+    if (tag[0])
+    {
+        char printable[4];
+        for (size_t i = 0; i < sizeof(printable); ++i)
+        {
+            printable[i] = tag[i] >= ' ' && tag[i] <= '~' ? tag[i] : '?';
+        }
+        FORMAT_TO(out, " in chunk '%@'", printable);
+    }
+    if (error != LoadError::open_failed)
+    {
+        FORMAT_TO(out, " at offset %@", offset);
+    }
+    if (detail)
+    {
+        FORMAT_TO(out, " (%@", detail);
+        if (expected != actual)
+        {
+            FORMAT_TO(out, ", got %@ and %@", expected, actual);
+        }
+        out.append(')');
+    }
+    return out.str();
 }
 
 void to_json(nlohmann::json &out, Block const &in)
@@ -369,6 +757,11 @@ void to_json(nlohmann::json &out, Block const &in)
         {"size_samples", in.size_samples},
         {"wave_id", in.wave_id},
         {"track", in.track},
+        {"parent_group", in.parent_group},
+        {"punch_generation", in.punch_generation},
+        {"previous_punch", in.previous_punch},
+        {"next_punch", in.next_punch},
+        {"original_index", in.original_index},
     };
 }
 
@@ -403,7 +796,11 @@ void to_json(nlohmann::json &out, Session const &in)
 {
     out = {
         {"sample_rate", in.sample_rate},
+        {"samples_in_session", in.samples_in_session},
+        {"bits_per_sample", in.bits_per_sample},
+        {"channels", in.channels},
         {"master_volume", in.master_volume},
+        {"master_volume_right", in.master_volume_right},
         {"filename", in.filename},
         {"tempo", in.tempo},
         {"tracks", in.tracks},
@@ -412,4 +809,18 @@ void to_json(nlohmann::json &out, Session const &in)
     };
 }
 
+void to_json(nlohmann::json &out, SessionHeader const &in)
+{
+    out = {
+        {"sample_rate", in.sample_rate},
+        {"samples_in_session", in.samples_in_session},
+        {"bits_per_sample", in.bits_per_sample},
+        {"channels", in.channels},
+        {"master_volume", in.master_volume},
+        {"master_volume_right", in.master_volume_right},
+        {"filename", in.filename},
+        {"tempo", in.tempo}
+    };
+}
+
 } // namespace CoolEdit
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -18,6 +19,11 @@ struct Block
     unsigned wave_offset_samples;
     unsigned wave_id;
     unsigned track;
+    unsigned parent_group;
+    unsigned punch_generation; // takes recorded over the same region count up
+    unsigned previous_punch;   // block ids of the neighbouring takes, 0 if none
+    unsigned next_punch;
+    unsigned original_index;
 };
 
 struct Wave
@@ -44,7 +50,11 @@ struct Tempo
 struct Session
 {
     unsigned sample_rate;
-    unsigned master_volume;
+    uint64_t samples_in_session;
+    unsigned bits_per_sample;
+    unsigned channels;
+    double master_volume;
+    double master_volume_right;
     std::string filename;
     Tempo tempo;
     std::vector<Track> tracks;
@@ -52,8 +62,113 @@ struct Session
     std::vector<Block> blocks;
 };
 
+enum class LoadError
+{
+    none,
+    open_failed,
+    read_failed,
+    bad_signature,
+    file_length_mismatch,
+    unexpected_chunk,
+    chunk_length_mismatch,
+    invalid_length,
+    limit_exceeded,
+};
+
+// Why and where parsing stopped. Owns no memory, so reporting a failure
+// never allocates; message() formats it on demand.
+struct LoadStatus
+{
+    LoadError error;
+    char tag[4];        // chunk being parsed, all NULs outside of any chunk
+    uint64_t offset;    // file offset of that chunk
+    const char *detail; // static description of the check that failed
+    uint64_t expected;
+    uint64_t actual;
+
+    bool ok() const
+    {
+        return error == LoadError::none;
+    }
+
+    std::string message() const;
+};
+
+// Hard caps on what a single (possibly hostile) session may make the parser
+// do. Exceeding one fails the load with LoadError::limit_exceeded.
+struct LoadLimits
+{
+    uint64_t max_allocation = 256 << 20; // bytes of parsed tracks, waves, blocks and strings
+    uint64_t max_string_length = 4096;   // wave file names
+    uint64_t max_records = 1 << 20;      // tracks, waves and blocks, each
+    unsigned max_depth = 4;              // nested chunk lists
+};
+
+struct LoadOptions
+{
+    LoadLimits limits;
+
+    // On a damaged chunk, scan ahead for the next recognizable chunk and
+    // carry on from there instead of failing.
+    bool salvage = false;
+};
+
+// Bytes a salvaging load could not parse, and why.
+struct SkippedRange
+{
+    uint64_t offset;
+    uint64_t length;
+    LoadStatus cause;
+};
+
+struct LoadResult
+{
+    Session session;
+    LoadStatus status;
+    std::vector<SkippedRange> skipped;
+};
+
+// Throws exception on malformed input.
 Session load_session(std::string const &path);
 
+// Same as load_session, but reports malformed input through
+// LoadResult::status instead of throwing. On failure, session holds whatever
+// was parsed before the error.
+LoadResult try_load_session(std::string const &path, LoadOptions const &options = {});
+
+// Same as try_load_session, but reads only the hdr, FILE and blk chunks and
+// seeks past every other chunk by its length, for tools that only need the
+// sample rate, waves and blocks. The session has no tracks and no tempo.
+// Safe to call from several threads at once.
+LoadResult try_load_structure(std::string const &path, LoadOptions const &options = {});
+
+// What a session's hdr and tmpo chunks say about it, enough for catalogs.
+struct SessionHeader
+{
+    unsigned sample_rate;
+    uint64_t samples_in_session;
+    unsigned bits_per_sample;
+    unsigned channels;
+    double master_volume;
+    double master_volume_right;
+    std::string filename;
+    Tempo tempo;
+};
+
+struct ProbeResult
+{
+    SessionHeader header;
+    LoadStatus status;
+};
+
+SessionHeader get_header(Session const &session);
+
+// Reads only the hdr and tmpo chunks, seeking past every other chunk by its
+// length and stopping once both are found, so that whole archives can be
+// swept quickly. Safe to call from several threads at once.
+ProbeResult probe_session(std::string const &path, LoadOptions const &options = {});
+
 void to_json(nlohmann::json &j, Session const &);
+void to_json(nlohmann::json &j, SessionHeader const &);
 
 } // namespace CoolEdit
@@ -0,0 +1,87 @@
+#include "Takes.h"
+
+#include <algorithm>
+
+namespace CoolEdit
+{
+
+namespace
+{
+
+size_t find_root(std::vector<size_t> &parents, size_t i)
+{
+    while (parents[i] != i)
+    {
+        parents[i] = parents[parents[i]];
+        i = parents[i];
+    }
+    return i;
+}
+
+} // namespace
+
+const size_t TakeGraph::npos;
+
+TakeGraph::TakeGraph(Session const &session)
+    : _alternate(session.blocks.size())
+{
+    auto &blocks = session.blocks;
+    _index.reserve(blocks.size());
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        _index.emplace(blocks[i].id, i);
+    }
+
+    // Links are followed both ways and may be inconsistent or circular in
+    // damaged sessions, so takes are grouped as connected components rather
+    // than by walking the lists.
+    std::vector<size_t> parents(blocks.size());
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        parents[i] = i;
+    }
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        for (auto id : {blocks[i].previous_punch, blocks[i].next_punch})
+        {
+            auto other = id ? find(id) : npos;
+            if (other != npos && other != i)
+            {
+                parents[find_root(parents, other)] = find_root(parents, i);
+            }
+        }
+    }
+
+    std::unordered_map<size_t, size_t> chain_of_root;
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        auto root = find_root(parents, i);
+        auto it = chain_of_root.find(root);
+        if (it == chain_of_root.end())
+        {
+            it = chain_of_root.emplace(root, _chains.size()).first;
+            _chains.emplace_back();
+        }
+        _chains[it->second].push_back(i);
+    }
+    // Blocks without other takes are not punch regions.
+    _chains.erase(remove_if(_chains.begin(), _chains.end(),
+                            [](std::vector<size_t> const &chain) { return chain.size() < 2; }),
+                  _chains.end());
+
+    for (auto &chain : _chains)
+    {
+        // Newest first; of equal generations, the block later in the session.
+        sort(chain.begin(), chain.end(), [&](size_t a, size_t b) {
+            return blocks[a].punch_generation != blocks[b].punch_generation
+                       ? blocks[a].punch_generation > blocks[b].punch_generation
+                       : a > b;
+        });
+        for (auto it = chain.begin() + 1; it != chain.end(); ++it)
+        {
+            _alternate[*it] = true;
+        }
+    }
+}
+
+} // namespace CoolEdit
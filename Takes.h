@@ -0,0 +1,48 @@
+#pragma once
+
+#include "SessionFile.h"
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+namespace CoolEdit
+{
+
+// Punch-in takes: blocks linked through Block::previous_punch and
+// next_punch are alternatives for the same region, and the one with the
+// highest punch_generation is the take Cool Edit plays.
+class TakeGraph
+{
+public:
+    static const size_t npos = size_t(-1);
+
+    explicit TakeGraph(Session const &session);
+
+    // Index into Session::blocks of the block with `id`, or npos.
+    size_t find(unsigned id) const
+    {
+        auto it = _index.find(id);
+        return it == _index.end() ? npos : it->second;
+    }
+
+    // The blocks of every punch region with more than one take, the active
+    // take first and the rest from newest to oldest.
+    std::vector<std::vector<size_t>> const &chains() const
+    {
+        return _chains;
+    }
+
+    // Whether a block is a take that is not heard.
+    bool is_alternate(size_t block) const
+    {
+        return _alternate[block];
+    }
+
+private:
+    std::unordered_map<unsigned, size_t> _index;
+    std::vector<std::vector<size_t>> _chains;
+    std::vector<char> _alternate;
+};
+
+} // namespace CoolEdit
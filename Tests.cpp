@@ -0,0 +1,63 @@
+#include "Timeline.h"
+
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace CoolEdit;
+
+namespace
+{
+
+int FAILURES = 0;
+
+void check_near(double actual, double expected, std::string const &what)
+{
+    if (std::fabs(actual - expected) > 1e-9)
+    {
+        std::cerr << "FAILED " << what << ": " << actual << ", expected " << expected << "\n";
+        ++FAILURES;
+    }
+}
+
+// Clips playing from inside their wave loop over their own part of it, in
+// seconds, as Live reads clips that are not warped.
+void test_clip_times_with_wave_offset()
+{
+    Session session{};
+    session.sample_rate = 44100;
+    session.tempo = {120, 4, 96};
+    // Half a second of the wave from 1, 2 and 3 s into it, every 2 s. Three,
+    // so that both the vector pass and the scalar tail are covered.
+    std::vector<Segment> clips;
+    for (uint64_t i = 0; i < 3; ++i)
+    {
+        clips.push_back({i * 88200, i * 88200 + 22050, 0, (i + 1) * 44100});
+    }
+    auto times = compute_clip_times(session, clips, {10, 10, 10});
+    for (size_t i = 0; i < clips.size(); ++i)
+    {
+        auto clip = "clip " + std::to_string(i);
+        check_near(times.start_beats[i], 4.0 * i, clip + " start");
+        check_near(times.end_beats[i], 4.0 * i + 1, clip + " end");
+        check_near(times.loop_start_seconds[i], i + 1.0, clip + " loop start");
+        check_near(times.loop_end_seconds[i], i + 1.5, clip + " loop end");
+        check_near(times.warp_end_seconds[i], 10, clip + " warp end seconds");
+        check_near(times.warp_end_beats[i], 20, clip + " warp end beats");
+    }
+}
+
+} // namespace
+
+int main()
+{
+    test_clip_times_with_wave_offset();
+    if (FAILURES)
+    {
+        std::cerr << FAILURES << " checks failed\n";
+        return 1;
+    }
+    std::cout << "All tests passed\n";
+    return 0;
+}
@@ -0,0 +1,258 @@
+#include "Timeline.h"
+
+#include "simd.h"
+
+#include <algorithm>
+#include <set>
+#include <unordered_map>
+
+namespace CoolEdit
+{
+
+namespace
+{
+
+struct Event
+{
+    uint64_t time;
+    size_t block;
+    bool starts;
+};
+
+std::vector<size_t> blocks_of_track(Session const &session, unsigned track)
+{
+    std::vector<size_t> blocks;
+    for (size_t i = 0; i < session.blocks.size(); ++i)
+    {
+        if (session.blocks[i].track == track)
+        {
+            blocks.push_back(i);
+        }
+    }
+    return blocks;
+}
+
+} // namespace
+
+TrackTimeline::TrackTimeline(Session const &session, unsigned track)
+    : TrackTimeline(session, blocks_of_track(session, track))
+{
+}
+
+TrackTimeline::TrackTimeline(Session const &session, std::vector<size_t> const &blocks)
+    : _hidden_blocks(0)
+{
+    std::vector<Event> events;
+    for (auto i : blocks)
+    {
+        auto &block = session.blocks[i];
+        if (block.size_samples)
+        {
+            events.push_back({block.offset_samples, i, true});
+            events.push_back({(uint64_t)block.offset_samples + block.size_samples, i, false});
+        }
+    }
+    sort(events.begin(), events.end(), [](Event const &a, Event const &b) { return a.time < b.time; });
+
+    // Sweep through the block boundaries keeping the blocks sounding at the
+    // time; the highest index is the one heard until the next boundary.
+    std::set<size_t> active;
+    uint64_t time = 0;
+    for (size_t i = 0; i < events.size();)
+    {
+        auto next = events[i].time;
+        if (!active.empty() && next > time)
+        {
+            auto index = *active.rbegin();
+            auto &block = session.blocks[index];
+            if (!_segments.empty() && _segments.back().block == index && _segments.back().end == time)
+            {
+                _segments.back().end = next;
+            }
+            else
+            {
+                _segments.push_back({time, next, index, block.wave_offset_samples + (time - block.offset_samples)});
+            }
+        }
+        for (; i < events.size() && events[i].time == next; ++i)
+        {
+            if (events[i].starts)
+            {
+                active.insert(events[i].block);
+            }
+            else
+            {
+                active.erase(events[i].block);
+            }
+        }
+        time = next;
+    }
+
+    // A block is hidden when it is not heard for its whole length.
+    std::unordered_map<size_t, uint64_t> heard;
+    for (auto &segment : _segments)
+    {
+        heard[segment.block] += segment.end - segment.start;
+    }
+    for (auto i : blocks)
+    {
+        if (heard[i] != session.blocks[i].size_samples)
+        {
+            ++_hidden_blocks;
+        }
+    }
+}
+
+Segment const *TrackTimeline::at(uint64_t t) const
+{
+    auto it = std::upper_bound(_segments.begin(), _segments.end(), t,
+                               [](uint64_t t, Segment const &segment) { return t < segment.start; });
+    if (it == _segments.begin() || t >= (it - 1)->end)
+    {
+        return nullptr;
+    }
+    return &*(it - 1);
+}
+
+std::vector<Segment> TrackTimeline::range(uint64_t begin, uint64_t end) const
+{
+    std::vector<Segment> result;
+    auto it = std::upper_bound(_segments.begin(), _segments.end(), begin,
+                               [](uint64_t t, Segment const &segment) { return t < segment.end; });
+    for (; it != _segments.end() && it->start < end; ++it)
+    {
+        auto segment = *it;
+        if (segment.start < begin)
+        {
+            segment.wave_offset += begin - segment.start;
+            segment.start = begin;
+        }
+        segment.end = std::min(segment.end, end);
+        result.push_back(segment);
+    }
+    return result;
+}
+
+size_t coalesce(Session const &session, std::vector<Segment> &segments)
+{
+    if (segments.empty())
+    {
+        return 0;
+    }
+    auto last = segments.begin();
+    for (auto it = segments.begin() + 1; it != segments.end(); ++it)
+    {
+        auto &previous = session.blocks[last->block];
+        auto &block = session.blocks[it->block];
+        auto continues = it->start == last->end && block.wave_id == previous.wave_id &&
+                         it->wave_offset == last->wave_offset + (last->end - last->start) &&
+                         block.left_volume == previous.left_volume && block.right_volume == previous.right_volume;
+        if (continues)
+        {
+            last->end = it->end;
+        }
+        else
+        {
+            *++last = *it;
+        }
+    }
+    auto removed = size_t(segments.end() - (last + 1));
+    segments.erase(last + 1, segments.end());
+    return removed;
+}
+
+std::vector<TrackTimeline> build_timelines(Session const &session)
+{
+    std::vector<std::vector<size_t>> blocks(session.tracks.size());
+    for (size_t i = 0; i < session.blocks.size(); ++i)
+    {
+        auto track = session.blocks[i].track;
+        if (track >= 1 && track <= blocks.size())
+        {
+            blocks[track - 1].push_back(i);
+        }
+    }
+    std::vector<TrackTimeline> timelines;
+    timelines.reserve(blocks.size());
+    for (auto &track_blocks : blocks)
+    {
+        timelines.emplace_back(session, track_blocks);
+    }
+    return timelines;
+}
+
+ClipTimes compute_clip_times(Session const &session, std::vector<Segment> const &clips,
+                             std::vector<double> const &wave_seconds)
+{
+    auto count = clips.size();
+    auto seconds_per_sample = 1.0 / session.sample_rate;
+    auto beats_per_second = session.tempo.beats_per_minute / 60.0;
+    auto beats_per_sample = seconds_per_sample * beats_per_second;
+
+    // Gather the inputs first so that the arithmetic is one branch-free pass.
+    std::vector<double> offsets(count), sizes(count), wave_offsets(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        offsets[i] = clips[i].start;
+        sizes[i] = clips[i].end - clips[i].start;
+        wave_offsets[i] = clips[i].wave_offset;
+    }
+
+    ClipTimes times;
+    for (auto field : {&times.start_beats, &times.end_beats, &times.loop_start_seconds, &times.loop_end_seconds,
+                       &times.warp_end_seconds, &times.warp_end_beats})
+    {
+        field->resize(count);
+    }
+
+    size_t i = 0;
+#if SIMD_SSE2
+    auto per_sample_beats = _mm_set1_pd(beats_per_sample);
+    auto per_sample_seconds = _mm_set1_pd(seconds_per_sample);
+    auto per_second_beats = _mm_set1_pd(beats_per_second);
+    for (; i + 2 <= count; i += 2)
+    {
+        auto start = _mm_mul_pd(_mm_loadu_pd(&offsets[i]), per_sample_beats);
+        auto size = _mm_loadu_pd(&sizes[i]);
+        auto loop_start = _mm_mul_pd(_mm_loadu_pd(&wave_offsets[i]), per_sample_seconds);
+        auto wave_length = _mm_loadu_pd(&wave_seconds[i]);
+        _mm_storeu_pd(&times.start_beats[i], start);
+        _mm_storeu_pd(&times.end_beats[i], _mm_add_pd(start, _mm_mul_pd(size, per_sample_beats)));
+        _mm_storeu_pd(&times.loop_start_seconds[i], loop_start);
+        _mm_storeu_pd(&times.loop_end_seconds[i], _mm_add_pd(loop_start, _mm_mul_pd(size, per_sample_seconds)));
+        _mm_storeu_pd(&times.warp_end_seconds[i], wave_length);
+        _mm_storeu_pd(&times.warp_end_beats[i], _mm_mul_pd(wave_length, per_second_beats));
+    }
+#elif SIMD_NEON && defined(__aarch64__)
+    auto per_sample_beats = vdupq_n_f64(beats_per_sample);
+    auto per_sample_seconds = vdupq_n_f64(seconds_per_sample);
+    auto per_second_beats = vdupq_n_f64(beats_per_second);
+    for (; i + 2 <= count; i += 2)
+    {
+        auto start = vmulq_f64(vld1q_f64(&offsets[i]), per_sample_beats);
+        auto size = vld1q_f64(&sizes[i]);
+        auto loop_start = vmulq_f64(vld1q_f64(&wave_offsets[i]), per_sample_seconds);
+        auto wave_length = vld1q_f64(&wave_seconds[i]);
+        vst1q_f64(&times.start_beats[i], start);
+        vst1q_f64(&times.end_beats[i], vaddq_f64(start, vmulq_f64(size, per_sample_beats)));
+        vst1q_f64(&times.loop_start_seconds[i], loop_start);
+        vst1q_f64(&times.loop_end_seconds[i], vaddq_f64(loop_start, vmulq_f64(size, per_sample_seconds)));
+        vst1q_f64(&times.warp_end_seconds[i], wave_length);
+        vst1q_f64(&times.warp_end_beats[i], vmulq_f64(wave_length, per_second_beats));
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        auto start = offsets[i] * beats_per_sample;
+        auto loop_start = wave_offsets[i] * seconds_per_sample;
+        times.start_beats[i] = start;
+        times.end_beats[i] = start + sizes[i] * beats_per_sample;
+        times.loop_start_seconds[i] = loop_start;
+        times.loop_end_seconds[i] = loop_start + sizes[i] * seconds_per_sample;
+        times.warp_end_seconds[i] = wave_seconds[i];
+        times.warp_end_beats[i] = wave_seconds[i] * beats_per_second;
+    }
+    return times;
+}
+
+} // namespace CoolEdit
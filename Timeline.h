@@ -0,0 +1,81 @@
+#pragma once
+
+#include "SessionFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace CoolEdit
+{
+
+// The part of a block that is heard: Cool Edit lets blocks on a track
+// overlap, and where they do, the block later in the session wins.
+struct Segment
+{
+    uint64_t start;       // session samples
+    uint64_t end;
+    size_t block;         // index into Session::blocks
+    uint64_t wave_offset; // wave sample heard at start
+};
+
+// What plays when on one track, as sorted, non-overlapping segments. Built in
+// O(n log n) for n blocks; lookups are O(log n).
+class TrackTimeline
+{
+public:
+    // `track` is 1-based, as in Block::track.
+    TrackTimeline(Session const &session, unsigned track);
+
+    // From the indices of one track's blocks.
+    TrackTimeline(Session const &session, std::vector<size_t> const &blocks);
+
+    std::vector<Segment> const &segments() const
+    {
+        return _segments;
+    }
+
+    // The segment playing at session sample t, or null during silence.
+    Segment const *at(uint64_t t) const;
+
+    // The segments overlapping [begin, end), trimmed to it.
+    std::vector<Segment> range(uint64_t begin, uint64_t end) const;
+
+    // How many blocks are partly or wholly hidden by later ones.
+    size_t hidden_blocks() const
+    {
+        return _hidden_blocks;
+    }
+
+private:
+    std::vector<Segment> _segments;
+    size_t _hidden_blocks;
+};
+
+// Merges runs of time-sorted segments that continue one another in the same
+// wave at the same volumes, as left by splitting a recording into blocks.
+// The merged segment refers to the run's first block. Returns how many
+// segments were merged away.
+size_t coalesce(Session const &session, std::vector<Segment> &segments);
+
+// One timeline per track, in track order.
+std::vector<TrackTimeline> build_timelines(Session const &session);
+
+// Where clips play and what of their samples, one array per field, as Live
+// reads them from a clip that is not warped: positions in the arrangement in
+// beats, positions in the sample in seconds.
+struct ClipTimes
+{
+    std::vector<double> start_beats;
+    std::vector<double> end_beats;
+    std::vector<double> loop_start_seconds;
+    std::vector<double> loop_end_seconds;
+    std::vector<double> warp_end_seconds;
+    std::vector<double> warp_end_beats;
+};
+
+// The times of `clips`, whose samples last `wave_seconds` each.
+ClipTimes compute_clip_times(Session const &session, std::vector<Segment> const &clips,
+                             std::vector<double> const &wave_seconds);
+
+} // namespace CoolEdit
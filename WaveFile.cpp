@@ -0,0 +1,581 @@
+#include "WaveFile.h"
+
+#include "log.h"
+#include "parallel.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace WaveFile
+{
+
+namespace
+{
+
+const uint16_t FORMAT_PCM = 1;
+const uint16_t FORMAT_IEEE_FLOAT = 3;
+const uint16_t FORMAT_EXTENSIBLE = 0xfffe;
+
+uint32_t get_u32(const uint8_t *p)
+{
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+uint16_t get_u16(const uint8_t *p)
+{
+    return uint16_t(p[0] | p[1] << 8);
+}
+
+uint8_t *put_u32(uint8_t *p, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        *p++ = uint8_t(value >> (8 * i));
+    }
+    return p;
+}
+
+uint8_t *put_u16(uint8_t *p, uint16_t value)
+{
+    *p++ = uint8_t(value);
+    *p++ = uint8_t(value >> 8);
+    return p;
+}
+
+uint8_t *put_tag(uint8_t *p, const char *tag)
+{
+    std::memcpy(p, tag, 4);
+    return p + 4;
+}
+
+// Serves reads from one up-front block covering the usual header layout,
+// falling back to pread() for chunks further into the file.
+class HeaderReader
+{
+public:
+    explicit HeaderReader(int fd)
+        : _fd(fd)
+    {
+        auto count = ::pread(fd, _head, sizeof(_head), 0);
+        _head_size = count > 0 ? (size_t)count : 0;
+    }
+
+    bool read(uint64_t offset, void *out, size_t size)
+    {
+        if (offset + size <= _head_size)
+        {
+            std::memcpy(out, _head + offset, size);
+            return true;
+        }
+        return ::pread(_fd, out, size, (off_t)offset) == (ssize_t)size;
+    }
+
+private:
+    int _fd;
+    uint8_t _head[4096];
+    size_t _head_size;
+};
+
+bool parse(HeaderReader &reader, Info &info)
+{
+    uint8_t riff[12];
+    if (!reader.read(0, riff, sizeof(riff)) || std::memcmp(riff, "RIFF", 4) != 0 ||
+        std::memcmp(riff + 8, "WAVE", 4) != 0)
+    {
+        return false;
+    }
+
+    bool have_format = false;
+    for (uint64_t offset = sizeof(riff); offset + 8 <= info.file_size;)
+    {
+        uint8_t chunk[8];
+        if (!reader.read(offset, chunk, sizeof(chunk)))
+        {
+            return false;
+        }
+        uint64_t size = get_u32(chunk + 4);
+        auto body = offset + sizeof(chunk);
+
+        if (std::memcmp(chunk, "fmt ", 4) == 0)
+        {
+            uint8_t format[40] = {};
+            if (size < 16 || !reader.read(body, format, std::min<uint64_t>(size, sizeof(format))))
+            {
+                return false;
+            }
+            auto tag = get_u16(format);
+            if (tag == FORMAT_EXTENSIBLE && size >= 26)
+            {
+                tag = get_u16(format + 24); // first two bytes of the sub-format GUID
+            }
+            info.encoding = tag == FORMAT_PCM ? Encoding::pcm
+                            : tag == FORMAT_IEEE_FLOAT ? Encoding::ieee_float
+                            : Encoding::unknown;
+            info.channels = get_u16(format + 2);
+            info.sample_rate = get_u32(format + 4);
+            info.block_align = get_u16(format + 12);
+            info.bits_per_sample = get_u16(format + 14);
+            info.format_offset = body;
+            info.format_size = (uint32_t)size;
+            have_format = true;
+        }
+        else if (std::memcmp(chunk, "data", 4) == 0)
+        {
+            // Writers that never finalized the header leave 0 or ~0 here.
+            if (size == 0 || body + size > info.file_size)
+            {
+                size = info.file_size - body;
+            }
+            info.data_offset = body;
+            info.data_size = size;
+            if (!have_format || info.block_align == 0)
+            {
+                return false;
+            }
+            info.frames = size / info.block_align;
+            return info.encoding != Encoding::unknown && info.channels > 0 && info.sample_rate > 0;
+        }
+        offset = body + size + (size & 1);
+    }
+    return false;
+}
+
+} // namespace
+
+Info probe(std::string const &path)
+{
+    Info info{};
+    auto fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return info;
+    }
+    struct stat status;
+    if (::fstat(fd, &status) == 0)
+    {
+        info.file_size = (uint64_t)status.st_size;
+        HeaderReader reader(fd);
+        info.valid = parse(reader, info);
+    }
+    ::close(fd);
+    if (!info.valid)
+    {
+        logv("Not a readable wave file: %@", path);
+    }
+    return info;
+}
+
+Reader::Reader(std::string const &path)
+    : _path(path)
+    , _info(probe(path))
+    , _fd(-1)
+    , _position(0)
+{
+    if (!_info.valid)
+    {
+        THROW("Not a readable wave file: %@", path);
+    }
+    if (!is_decodable(_info))
+    {
+        THROW("Unsupported sample format in %@: %@ bits in %@ byte frames", path, _info.bits_per_sample,
+              _info.block_align);
+    }
+    _fd = ::open(path.c_str(), O_RDONLY);
+    if (_fd < 0)
+    {
+        THROW("Cannot open %@: %@", path, std::strerror(errno));
+    }
+}
+
+Reader::~Reader()
+{
+    if (_fd >= 0)
+    {
+        ::close(_fd);
+    }
+}
+
+void Reader::seek(uint64_t frame)
+{
+    _position = std::min(frame, _info.frames);
+}
+
+size_t Reader::read_raw(void *out, size_t frames)
+{
+    frames = (size_t)std::min<uint64_t>(frames, _info.frames - _position);
+    if (frames == 0)
+    {
+        return 0;
+    }
+    auto offset = _info.data_offset + _position * _info.block_align;
+    auto count = ::pread(_fd, out, frames * _info.block_align, (off_t)offset);
+    if (count < 0)
+    {
+        THROW("Cannot read %@: %@", _path, std::strerror(errno));
+    }
+    // The header may promise more data than a truncated file holds.
+    frames = (size_t)count / _info.block_align;
+    _position = frames ? _position + frames : _info.frames;
+    return frames;
+}
+
+size_t Reader::read(float *out, size_t frames)
+{
+    _raw.resize(std::min<uint64_t>(frames, _info.frames - _position) * _info.block_align);
+    frames = read_raw(_raw.data(), frames);
+    decode(_info, _raw.data(), frames, out);
+    return frames;
+}
+
+bool is_decodable(Info const &info)
+{
+    if (!info.valid || info.channels == 0)
+    {
+        return false;
+    }
+    auto container = info.block_align / info.channels;
+    auto supported = info.encoding == Encoding::pcm ? container >= 1 && container <= 4
+                                                    : container == 4 || container == 8;
+    return supported && container * info.channels == info.block_align;
+}
+
+void decode(Info const &info, void const *raw, size_t frames, float *out)
+{
+    auto samples = frames * info.channels;
+    auto container = info.block_align / info.channels;
+    auto p = static_cast<const uint8_t *>(raw);
+    if (info.encoding == Encoding::ieee_float)
+    {
+        for (size_t i = 0; i < samples; ++i, p += container)
+        {
+            if (container == 4)
+            {
+                std::memcpy(&out[i], p, 4);
+            }
+            else
+            {
+                double value;
+                std::memcpy(&value, p, 8);
+                out[i] = (float)value;
+            }
+        }
+        return;
+    }
+    switch (container)
+    {
+    case 1:
+        for (size_t i = 0; i < samples; ++i)
+        {
+            out[i] = (p[i] - 128) * (1.0f / 128);
+        }
+        break;
+    case 2:
+        for (size_t i = 0; i < samples; ++i, p += 2)
+        {
+            out[i] = int16_t(get_u16(p)) * (1.0f / 32768);
+        }
+        break;
+    case 3:
+        for (size_t i = 0; i < samples; ++i, p += 3)
+        {
+            out[i] = int32_t(uint32_t(p[0]) << 8 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 24) * (1.0f / 2147483648.0f);
+        }
+        break;
+    default:
+        for (size_t i = 0; i < samples; ++i, p += 4)
+        {
+            out[i] = int32_t(get_u32(p)) * (1.0f / 2147483648.0f);
+        }
+        break;
+    }
+}
+
+namespace
+{
+
+const size_t HEADER_SIZE = 12 + 8 + 18 + 8 + 4 + 8;
+
+void write_fully(int fd, std::string const &path, const void *data, size_t size, off_t offset)
+{
+    auto p = static_cast<const uint8_t *>(data);
+    while (size)
+    {
+        auto count = ::pwrite(fd, p, size, offset);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            THROW("Cannot write %@: %@", path, std::strerror(errno));
+        }
+        p += count;
+        size -= count;
+        offset += count;
+    }
+}
+
+} // namespace
+
+Writer::Writer(std::string const &path, unsigned sample_rate, unsigned channels, Encoding encoding,
+               unsigned bits_per_sample)
+    : _path(path)
+    , _encoding(encoding)
+    , _bits_per_sample(bits_per_sample)
+    , _block_align(channels * ((bits_per_sample + 7) / 8))
+    , _fd(-1)
+    , _frames(0)
+{
+    if (encoding == Encoding::unknown || channels == 0 || bits_per_sample == 0)
+    {
+        THROW("Cannot write %@ channels of %@ bit samples to %@", channels, bits_per_sample, path);
+    }
+    _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (_fd < 0)
+    {
+        THROW("Cannot create %@: %@", path, std::strerror(errno));
+    }
+
+    // Sizes stay zero until finish(); readers treat that as unfinalized.
+    uint8_t header[HEADER_SIZE];
+    auto p = put_tag(header, "RIFF");
+    p = put_u32(p, 0);
+    p = put_tag(p, "WAVE");
+    p = put_tag(p, "fmt ");
+    p = put_u32(p, 18);
+    p = put_u16(p, encoding == Encoding::pcm ? FORMAT_PCM : FORMAT_IEEE_FLOAT);
+    p = put_u16(p, uint16_t(channels));
+    p = put_u32(p, sample_rate);
+    p = put_u32(p, sample_rate * _block_align);
+    p = put_u16(p, uint16_t(_block_align));
+    p = put_u16(p, uint16_t(bits_per_sample));
+    p = put_u16(p, 0);
+    p = put_tag(p, "fact");
+    p = put_u32(p, 4);
+    p = put_u32(p, 0);
+    p = put_tag(p, "data");
+    put_u32(p, 0);
+    write_fully(_fd, _path, header, sizeof(header), 0);
+}
+
+Writer::~Writer()
+{
+    if (_fd >= 0)
+    {
+        ::close(_fd);
+    }
+}
+
+void Writer::write(float const *samples, size_t frames)
+{
+    ASSERT(_encoding == Encoding::ieee_float && _bits_per_sample == 32, "Writing floats to %@", _path);
+    // Samples go out in host byte order, which is little endian everywhere
+    // this builds.
+    write_raw(samples, frames);
+}
+
+void Writer::write_raw(void const *data, size_t frames)
+{
+    write_raw_at(_frames, data, frames);
+}
+
+void Writer::write_raw_at(uint64_t frame, void const *data, size_t frames)
+{
+    write_fully(_fd, _path, data, frames * _block_align, off_t(HEADER_SIZE + frame * _block_align));
+    _frames = std::max(_frames, frame + frames);
+}
+
+void Writer::finish()
+{
+    auto data_size = _frames * _block_align;
+    if (data_size & 1)
+    {
+        uint8_t pad = 0;
+        write_fully(_fd, _path, &pad, 1, off_t(HEADER_SIZE + data_size));
+    }
+    if (HEADER_SIZE - 8 + data_size + (data_size & 1) > UINT32_MAX)
+    {
+        THROW("Too much audio for a wave file: %@", _path);
+    }
+    uint8_t size[4];
+    put_u32(size, uint32_t(HEADER_SIZE - 8 + data_size + (data_size & 1)));
+    write_fully(_fd, _path, size, 4, 4);
+    put_u32(size, uint32_t(_frames));
+    write_fully(_fd, _path, size, 4, HEADER_SIZE - 12);
+    put_u32(size, uint32_t(data_size));
+    write_fully(_fd, _path, size, 4, HEADER_SIZE - 4);
+    if (::close(_fd) != 0)
+    {
+        _fd = -1;
+        THROW("Cannot write %@: %@", _path, std::strerror(errno));
+    }
+    _fd = -1;
+}
+
+namespace
+{
+
+// Copies `size` bytes between file offsets, falling back to pread/pwrite
+// where the kernel cannot copy between the two files itself.
+void copy_range(int in, std::string const &in_path, uint64_t in_offset, int out, std::string const &out_path,
+                uint64_t out_offset, uint64_t size)
+{
+#ifdef __linux__
+    while (size)
+    {
+        loff_t from = (loff_t)in_offset, to = (loff_t)out_offset;
+        auto count = ::copy_file_range(in, &from, out, &to, (size_t)std::min<uint64_t>(size, 1 << 30), 0);
+        if (count <= 0)
+        {
+            if (count == 0 || errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)
+            {
+                break;
+            }
+            THROW("Cannot copy %@ to %@: %@", in_path, out_path, std::strerror(errno));
+        }
+        in_offset += count;
+        out_offset += count;
+        size -= count;
+    }
+#endif
+    std::vector<uint8_t> buffer((size_t)std::min<uint64_t>(size, 1 << 20));
+    while (size)
+    {
+        auto count = ::pread(in, buffer.data(), (size_t)std::min<uint64_t>(size, buffer.size()), (off_t)in_offset);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            THROW("Cannot read %@: %@", in_path, count ? std::strerror(errno) : "unexpected end of file");
+        }
+        write_fully(out, out_path, buffer.data(), (size_t)count, (off_t)out_offset);
+        in_offset += count;
+        out_offset += count;
+        size -= count;
+    }
+}
+
+} // namespace
+
+void extract(Info const &info, std::string const &in, std::string const &out, uint64_t first_frame,
+             uint64_t frames)
+{
+    if (!info.valid || first_frame + frames > info.frames)
+    {
+        THROW("Cannot extract frames %@ to %@ of %@", first_frame, first_frame + frames, in);
+    }
+    auto data_size = frames * info.block_align;
+    auto format_size = info.format_size + (info.format_size & 1);
+    auto header_size = 12 + 8 + format_size + 8;
+    if (header_size - 8 + data_size + (data_size & 1) > UINT32_MAX)
+    {
+        THROW("Too much audio for a wave file: %@", out);
+    }
+
+    auto input = ::open(in.c_str(), O_RDONLY);
+    if (input < 0)
+    {
+        THROW("Cannot open %@: %@", in, std::strerror(errno));
+    }
+    auto temporary = out + ".part";
+    auto output = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output < 0)
+    {
+        auto error = errno;
+        ::close(input);
+        THROW("Cannot create %@: %@", temporary, std::strerror(error));
+    }
+    try
+    {
+        std::vector<uint8_t> header(header_size);
+        auto p = put_tag(header.data(), "RIFF");
+        p = put_u32(p, uint32_t(header_size - 8 + data_size + (data_size & 1)));
+        p = put_tag(p, "WAVE");
+        p = put_tag(p, "fmt ");
+        p = put_u32(p, info.format_size);
+        if (::pread(input, p, info.format_size, (off_t)info.format_offset) != (ssize_t)info.format_size)
+        {
+            THROW("Cannot read %@: %@", in, std::strerror(errno));
+        }
+        p += format_size;
+        p = put_tag(p, "data");
+        put_u32(p, uint32_t(data_size));
+        write_fully(output, temporary, header.data(), header.size(), 0);
+
+        copy_range(input, in, info.data_offset + first_frame * info.block_align, output, temporary, header_size,
+                   data_size);
+        if (data_size & 1)
+        {
+            uint8_t pad = 0;
+            write_fully(output, temporary, &pad, 1, off_t(header_size + data_size));
+        }
+    }
+    catch (...)
+    {
+        ::close(input);
+        ::close(output);
+        ::unlink(temporary.c_str());
+        throw;
+    }
+    ::close(input);
+    if (::close(output) != 0)
+    {
+        auto error = errno;
+        ::unlink(temporary.c_str());
+        THROW("Cannot write %@: %@", temporary, std::strerror(error));
+    }
+    if (::rename(temporary.c_str(), out.c_str()) != 0)
+    {
+        auto error = errno;
+        ::unlink(temporary.c_str());
+        THROW("Cannot replace %@: %@", out, std::strerror(error));
+    }
+}
+
+Info const &ProbeCache::get(std::string const &path)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _infos.find(path);
+        if (it != _infos.end())
+        {
+            return it->second;
+        }
+    }
+    auto info = probe(path);
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _infos.emplace(path, info).first->second;
+}
+
+void ProbeCache::probe_all(std::vector<std::string> const &paths, unsigned threads)
+{
+    std::vector<std::string> missing;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto &path : paths)
+        {
+            if (!_infos.count(path))
+            {
+                missing.push_back(path);
+            }
+        }
+    }
+    std::sort(missing.begin(), missing.end());
+    missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+    parallel_for(missing.size(), [&](size_t i) { get(missing[i]); }, threads);
+}
+
+void ProbeCache::put(std::string const &path, Info const &info)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _infos.emplace(path, info);
+}
+
+} // namespace WaveFile
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace WaveFile
+{
+
+enum class Encoding
+{
+    unknown,
+    pcm,
+    ieee_float,
+};
+
+struct Info
+{
+    bool valid;
+    Encoding encoding;
+    unsigned sample_rate;
+    unsigned channels;
+    unsigned bits_per_sample;
+    unsigned block_align;  // bytes per frame
+    uint64_t frames;
+    uint64_t file_size;
+    uint64_t data_offset;  // file offset of the first sample
+    uint64_t data_size;
+    uint64_t format_offset; // file offset of the fmt chunk body
+    uint32_t format_size;
+
+    double duration_seconds() const
+    {
+        return sample_rate ? frames / (double)sample_rate : 0;
+    }
+};
+
+// Reads the RIFF header chunks of a wave file with pread(), never touching
+// sample data. Returns an Info with valid == false if the file is missing or
+// not a supported wave file.
+Info probe(std::string const &path);
+
+// Whether decode() handles the file's format: 8 to 32-bit PCM, 32 and 64-bit
+// float.
+bool is_decodable(Info const &info);
+
+// Converts `frames` frames as stored in the file described by `info` to
+// interleaved floats in [-1, 1).
+void decode(Info const &info, void const *raw, size_t frames, float *out);
+
+// Streams the samples of a wave file as interleaved floats in [-1, 1),
+// whatever the stored PCM or float format. Throws exception if the file cannot
+// be opened or decoded.
+class Reader
+{
+public:
+    explicit Reader(std::string const &path);
+    ~Reader();
+    Reader(Reader const &) = delete;
+    Reader &operator=(Reader const &) = delete;
+
+    Info const &info() const
+    {
+        return _info;
+    }
+
+    // Reads up to `frames` frames into out, which must hold frames * channels
+    // floats. Returns the number of frames read, zero at the end of the data.
+    size_t read(float *out, size_t frames);
+
+    // Same as read, but leaves the frames in the file's own format; out must
+    // hold frames * block_align bytes.
+    size_t read_raw(void *out, size_t frames);
+
+    // Continues reading from `frame`, clamped to the end of the data.
+    void seek(uint64_t frame);
+
+private:
+    std::string _path;
+    Info _info;
+    int _fd;
+    uint64_t _position; // frames read so far
+    std::vector<uint8_t> _raw;
+};
+
+// Writes a wave file, 32-bit float unless told otherwise. The header sizes are
+// filled in by finish(), without which the file is left incomplete. Throws
+// exception on I/O errors.
+class Writer
+{
+public:
+    Writer(std::string const &path, unsigned sample_rate, unsigned channels,
+           Encoding encoding = Encoding::ieee_float, unsigned bits_per_sample = 32);
+    ~Writer();
+    Writer(Writer const &) = delete;
+    Writer &operator=(Writer const &) = delete;
+
+    // Appends `frames` interleaved frames. Only for 32-bit float files.
+    void write(float const *samples, size_t frames);
+
+    // Appends `frames` frames already in the file's format.
+    void write_raw(void const *data, size_t frames);
+
+    // Writes `frames` frames already in the file's format at frame `frame`,
+    // growing the file to cover them. Frames never written are zero bytes.
+    void write_raw_at(uint64_t frame, void const *data, size_t frames);
+
+    void finish();
+
+private:
+    std::string _path;
+    Encoding _encoding;
+    unsigned _bits_per_sample;
+    unsigned _block_align;
+    int _fd;
+    uint64_t _frames;
+};
+
+// Writes frames [first_frame, first_frame + frames) of the wave file at `in`,
+// described by `info`, to `out` in the same format. Only the header is
+// rebuilt; the samples are copied as is, in the kernel where possible. `out`
+// is written as `out` + ".part" and renamed into place once complete. Throws
+// exception on I/O errors.
+void extract(Info const &info, std::string const &in, std::string const &out, uint64_t first_frame,
+             uint64_t frames);
+
+// Probe results by path, safe to share between threads and meant to be kept
+// for a whole batch of conversions.
+class ProbeCache
+{
+public:
+    // Probes on a miss. The reference stays valid for the cache's lifetime.
+    Info const &get(std::string const &path);
+
+    // Probes every path not cached yet, in parallel.
+    void probe_all(std::vector<std::string> const &paths, unsigned threads = 0);
+
+    // Caches what is already known of a file, e.g. from a sample index, unless
+    // the file is cached already: entries never change once get() may have
+    // handed them out.
+    void put(std::string const &path, Info const &info);
+
+private:
+    std::mutex _mutex;
+    std::unordered_map<std::string, Info> _infos;
+};
+
+} // namespace WaveFile
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#include <cctype>
+#include <cstdint>
+#include <string>
+
+// `text` in lowercase, which is how sample names are compared, since the
+// sessions come from Windows.
+inline std::string fold(std::string text)
+{
+    for (auto &c : text)
+    {
+        c = (char)std::tolower((unsigned char)c);
+    }
+    return text;
+}
+
+// The modification time of a file in nanoseconds, what indexes and caches are
+// checked against.
+inline int64_t mtime_of(struct stat const &status)
+{
+#ifdef __APPLE__
+    return status.st_mtimespec.tv_sec * 1000000000LL + status.st_mtimespec.tv_nsec;
+#else
+    return status.st_mtim.tv_sec * 1000000000LL + status.st_mtim.tv_nsec;
+#endif
+}
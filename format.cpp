@@ -0,0 +1,135 @@
+#include "format.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace fmt
+{
+
+void Buffer::append(const char *s, size_t length)
+{
+    auto available = _capacity - _size;
+    if (length > available)
+    {
+        length = available;
+        _truncated = true;
+    }
+    std::memcpy(_data + _size, s, length);
+    _size += length;
+}
+
+void Buffer::append(char c, size_t count)
+{
+    auto available = _capacity - _size;
+    if (count > available)
+    {
+        count = available;
+        _truncated = true;
+    }
+    std::memset(_data + _size, c, count);
+    _size += count;
+}
+
+namespace
+{
+
+// Writes [s, s + length) padded to the spec's width. Zero fill goes after a
+// leading sign so that "-0042" rather than "00-42" comes out.
+void pad(Buffer &out, Spec const &spec, const char *s, size_t length)
+{
+    auto padding = spec.width > length ? spec.width - length : 0;
+    if (spec.left)
+    {
+        out.append(s, length);
+        out.append(' ', padding);
+        return;
+    }
+    if (spec.fill == '0' && length && (s[0] == '-' || s[0] == '+'))
+    {
+        out.append(s[0]);
+        ++s;
+        --length;
+    }
+    out.append(spec.fill, padding);
+    out.append(s, length);
+}
+
+} // namespace
+
+void write_integer(Buffer &out, Spec const &spec, unsigned long long magnitude, bool negative)
+{
+    static const char *const LOWER = "0123456789abcdef";
+    static const char *const UPPER = "0123456789ABCDEF";
+
+    char digits[24];
+    auto end = digits + sizeof(digits);
+    auto p = end;
+    auto hex = spec.conversion == 'x' || spec.conversion == 'X';
+    auto base = hex ? 16u : 10u;
+    auto table = spec.conversion == 'X' ? UPPER : LOWER;
+    do
+    {
+        *--p = table[magnitude % base];
+        magnitude /= base;
+    } while (magnitude);
+    if (negative)
+    {
+        *--p = '-';
+    }
+    pad(out, spec, p, end - p);
+}
+
+void write_floating(Buffer &out, Spec const &spec, double value)
+{
+    char text[64];
+    int length;
+    if (spec.conversion == 'f')
+    {
+        length = std::snprintf(text, sizeof(text), "%.*f", spec.precision < 0 ? 6 : spec.precision, value);
+    }
+    else
+    {
+        // Same as the default std::ostream representation.
+        length = std::snprintf(text, sizeof(text), "%.*g", spec.precision < 0 ? 6 : spec.precision, value);
+    }
+    pad(out, spec, text, std::min<size_t>(std::max(length, 0), sizeof(text) - 1));
+}
+
+void write_string(Buffer &out, Spec const &spec, const char *s, size_t length)
+{
+    if (spec.precision >= 0)
+    {
+        length = std::min<size_t>(length, spec.precision);
+    }
+    pad(out, spec, s, length);
+}
+
+void write_bytes(Buffer &out, Spec const &, const unsigned char *bytes, size_t count)
+{
+    static const char *const HEX = "0123456789abcdef";
+    for (size_t i = 0; i < count; ++i)
+    {
+        char pair[2] = {HEX[bytes[i] >> 4], HEX[bytes[i] & 0xf]};
+        out.append(pair, 2);
+    }
+}
+
+void format_segments(Buffer &out, Segment const *segments, size_t count, Argument const *arguments)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto &segment = segments[i];
+        if (segment.literal)
+        {
+            out.append(segment.literal, segment.length);
+        }
+        else
+        {
+            auto &argument = *arguments++;
+            argument.write(out, segment.spec, argument.value);
+        }
+    }
+}
+
+} // namespace fmt
@@ -0,0 +1,529 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <type_traits>
+
+// Format strings are parsed at compile time into literal and argument
+// segments, and checked against the argument list with static_assert.
+//
+// Placeholders are %[-][0][width][.precision]conversion, where conversion is
+// one of:
+//   @  any value, in its natural representation
+//   d  signed or unsigned integer
+//   u  unsigned integer
+//   x  lowercase hexadecimal integer
+//   X  uppercase hexadecimal integer
+//   f  fixed point floating point (default precision 6)
+//   s  string (precision limits the number of characters)
+//   c  character
+// and %% is a literal percent sign.
+//
+// Use FORMAT_TO() to append to a buffer and FORMAT() to build a std::string.
+// Types other than numbers, characters, strings and arrays thereof are
+// formatted by an ADL-visible format_value(fmt::Buffer &, T const &).
+
+namespace fmt
+{
+
+struct Spec
+{
+    char conversion = '@';
+    char fill = ' ';
+    bool left = false;
+    unsigned width = 0;
+    int precision = -1;
+};
+
+struct Segment
+{
+    const char *literal; // null for an argument placeholder
+    size_t length;
+    Spec spec;
+};
+
+template <size_t N>
+struct Compiled
+{
+    Segment segments[N];
+    size_t count;
+};
+
+enum class Error
+{
+    none,
+    malformed_placeholder,
+    too_few_arguments,
+    too_many_arguments,
+    type_mismatch,
+};
+
+enum class Kind
+{
+    boolean,
+    character,
+    signed_integer,
+    unsigned_integer,
+    floating,
+    string,
+    fixed_string,
+    bytes,
+    array,
+    other,
+};
+
+template <typename T, typename = void>
+struct KindOf : std::integral_constant<Kind, Kind::other>
+{
+};
+
+template <typename T>
+struct KindOf<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type>
+    : std::integral_constant<Kind, Kind::signed_integer>
+{
+};
+
+template <typename T>
+struct KindOf<T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type>
+    : std::integral_constant<Kind, Kind::unsigned_integer>
+{
+};
+
+template <typename T>
+struct KindOf<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+    : std::integral_constant<Kind, Kind::floating>
+{
+};
+
+template <>
+struct KindOf<bool> : std::integral_constant<Kind, Kind::boolean>
+{
+};
+
+template <>
+struct KindOf<char> : std::integral_constant<Kind, Kind::character>
+{
+};
+
+template <>
+struct KindOf<const char *> : std::integral_constant<Kind, Kind::string>
+{
+};
+
+template <>
+struct KindOf<char *> : std::integral_constant<Kind, Kind::string>
+{
+};
+
+template <>
+struct KindOf<std::string> : std::integral_constant<Kind, Kind::string>
+{
+};
+
+template <size_t N>
+struct KindOf<char[N]> : std::integral_constant<Kind, Kind::fixed_string>
+{
+};
+
+template <size_t N>
+struct KindOf<unsigned char[N]> : std::integral_constant<Kind, Kind::bytes>
+{
+};
+
+template <typename T, size_t N>
+struct KindOf<T[N], typename std::enable_if<!std::is_same<T, char>::value && !std::is_same<T, unsigned char>::value>::type>
+    : std::integral_constant<Kind, Kind::array>
+{
+};
+
+template <typename... Args>
+struct Types
+{
+};
+
+// Only used in unevaluated context to name the argument types.
+template <typename... Args>
+Types<Args...> types(Args const &...);
+
+constexpr bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Parses the placeholder following a '%' and returns the position after its
+// conversion character, or null if it is malformed.
+constexpr const char *parse_spec(const char *p, Spec &spec)
+{
+    while (*p == '-' || *p == '0')
+    {
+        if (*p == '-')
+        {
+            spec.left = true;
+        }
+        else
+        {
+            spec.fill = '0';
+        }
+        ++p;
+    }
+    while (is_digit(*p))
+    {
+        spec.width = spec.width * 10 + (*p++ - '0');
+    }
+    if (*p == '.')
+    {
+        ++p;
+        if (!is_digit(*p))
+        {
+            return nullptr;
+        }
+        spec.precision = 0;
+        while (is_digit(*p))
+        {
+            spec.precision = spec.precision * 10 + (*p++ - '0');
+        }
+    }
+    switch (*p)
+    {
+    case '@':
+    case 'd':
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'f':
+    case 's':
+    case 'c':
+        spec.conversion = *p;
+        return p + 1;
+    default:
+        return nullptr;
+    }
+}
+
+constexpr bool accepts(char conversion, Kind kind)
+{
+    switch (conversion)
+    {
+    case 'd':
+    case 'x':
+    case 'X':
+        return kind == Kind::signed_integer || kind == Kind::unsigned_integer || kind == Kind::character;
+    case 'u':
+        return kind == Kind::unsigned_integer;
+    case 'f':
+        return kind == Kind::floating;
+    case 's':
+        return kind == Kind::string || kind == Kind::fixed_string;
+    case 'c':
+        return kind == Kind::character;
+    default:
+        return true;
+    }
+}
+
+template <typename... Args>
+constexpr Error check(const char *fmt, Types<Args...>)
+{
+    const Kind kinds[] = {KindOf<typename std::remove_cv<Args>::type>::value..., Kind::other};
+    size_t argument = 0;
+    for (auto p = fmt; *p;)
+    {
+        if (*p++ != '%')
+        {
+            continue;
+        }
+        if (*p == '%')
+        {
+            ++p;
+            continue;
+        }
+        Spec spec{};
+        p = parse_spec(p, spec);
+        if (!p)
+        {
+            return Error::malformed_placeholder;
+        }
+        if (argument == sizeof...(Args))
+        {
+            return Error::too_few_arguments;
+        }
+        if (!accepts(spec.conversion, kinds[argument++]))
+        {
+            return Error::type_mismatch;
+        }
+    }
+    return argument == sizeof...(Args) ? Error::none : Error::too_many_arguments;
+}
+
+// Upper bound of the number of segments check() accepted for fmt.
+constexpr size_t count_segments(const char *fmt)
+{
+    size_t count = 1;
+    for (auto p = fmt; *p; ++p)
+    {
+        count += *p == '%' ? 2 : 0;
+        p += p[0] == '%' && p[1] == '%';
+    }
+    return count;
+}
+
+template <size_t N>
+constexpr Compiled<N> compile(const char *fmt)
+{
+    Compiled<N> result{};
+    auto literal = fmt;
+    auto p = fmt;
+    while (*p)
+    {
+        if (*p != '%')
+        {
+            ++p;
+            continue;
+        }
+        if (p != literal)
+        {
+            result.segments[result.count++] = Segment{literal, size_t(p - literal), Spec{}};
+        }
+        if (p[1] == '%')
+        {
+            // The second '%' starts the next literal.
+            literal = p + 1;
+            p += 2;
+            continue;
+        }
+        Spec spec{};
+        p = parse_spec(p + 1, spec);
+        result.segments[result.count++] = Segment{nullptr, 0, spec};
+        literal = p;
+    }
+    if (p != literal)
+    {
+        result.segments[result.count++] = Segment{literal, size_t(p - literal), Spec{}};
+    }
+    return result;
+}
+
+// Fixed-capacity output that never allocates. Output beyond the capacity is
+// dropped and the buffer is marked truncated.
+class Buffer
+{
+public:
+    Buffer(char *data, size_t capacity)
+        : _data(data)
+        , _capacity(capacity)
+    {
+    }
+
+    Buffer(Buffer const &) = delete;
+    Buffer &operator=(Buffer const &) = delete;
+
+    void append(const char *s, size_t length);
+    void append(char c, size_t count = 1);
+
+    void clear()
+    {
+        _size = 0;
+        _truncated = false;
+    }
+
+    const char *data() const
+    {
+        return _data;
+    }
+
+    size_t size() const
+    {
+        return _size;
+    }
+
+    bool truncated() const
+    {
+        return _truncated;
+    }
+
+    std::string str() const
+    {
+        return {_data, _size};
+    }
+
+private:
+    char *_data;
+    size_t _capacity;
+    size_t _size = 0;
+    bool _truncated = false;
+};
+
+template <size_t N>
+class StackBuffer : public Buffer
+{
+public:
+    StackBuffer()
+        : Buffer(_storage, N)
+    {
+    }
+
+private:
+    char _storage[N];
+};
+
+void write_integer(Buffer &out, Spec const &spec, unsigned long long magnitude, bool negative);
+void write_floating(Buffer &out, Spec const &spec, double value);
+void write_string(Buffer &out, Spec const &spec, const char *s, size_t length);
+void write_bytes(Buffer &out, Spec const &spec, const unsigned char *bytes, size_t count);
+
+template <typename T>
+void write_value(Buffer &out, Spec const &spec, T const &value);
+
+template <typename T>
+void write_kind(Buffer &out, Spec const &spec, T const &value, std::integral_constant<Kind, Kind::boolean>)
+{
+    value ? write_string(out, spec, "true", 4) : write_string(out, spec, "false", 5);
+}
+
+template <typename T>
+void write_kind(Buffer &out, Spec const &spec, T const &value, std::integral_constant<Kind, Kind::character>)
+{
+    if (spec.conversion == '@' || spec.conversion == 'c')
+    {
+        write_string(out, spec, &value, 1);
+    }
+    else
+    {
+        write_integer(out, spec, (unsigned char)value, false);
+    }
+}
+
+template <typename T>
+void write_kind(Buffer &out, Spec const &spec, T const &value, std::integral_constant<Kind, Kind::signed_integer>)
+{
+    auto magnitude = value < 0 ? 0ull - (unsigned long long)value : (unsigned long long)value;
+    write_integer(out, spec, magnitude, value < 0);
+}
+
+template <typename T>
+void write_kind(Buffer &out, Spec const &spec, T const &value, std::integral_constant<Kind, Kind::unsigned_integer>)
+{
+    write_integer(out, spec, value, false);
+}
+
+template <typename T>
+void write_kind(Buffer &out, Spec const &spec, T const &value, std::integral_constant<Kind, Kind::floating>)
+{
+    write_floating(out, spec, value);
+}
+
+inline void write_kind(Buffer &out, Spec const &spec, const char *value, std::integral_constant<Kind, Kind::string>)
+{
+    auto length = std::char_traits<char>::length(value);
+    write_string(out, spec, value, length);
+}
+
+inline void write_kind(Buffer &out, Spec const &spec, std::string const &value, std::integral_constant<Kind, Kind::string>)
+{
+    write_string(out, spec, value.data(), value.size());
+}
+
+// Fixed-size character fields are not necessarily NUL-terminated.
+template <size_t N>
+void write_kind(Buffer &out, Spec const &spec, char const (&value)[N], std::integral_constant<Kind, Kind::fixed_string>)
+{
+    size_t length = 0;
+    while (length < N && value[length])
+    {
+        ++length;
+    }
+    write_string(out, spec, value, length);
+}
+
+template <size_t N>
+void write_kind(Buffer &out, Spec const &spec, unsigned char const (&value)[N], std::integral_constant<Kind, Kind::bytes>)
+{
+    write_bytes(out, spec, value, N);
+}
+
+template <typename T, size_t N>
+void write_kind(Buffer &out, Spec const &spec, T const (&value)[N], std::integral_constant<Kind, Kind::array>)
+{
+    out.append('{');
+    for (size_t i = 0; i < N; ++i)
+    {
+        if (i)
+        {
+            out.append(", ", 2);
+        }
+        write_value(out, spec, value[i]);
+    }
+    out.append('}');
+}
+
+template <typename T>
+void write_kind(Buffer &out, Spec const &, T const &value, std::integral_constant<Kind, Kind::other>)
+{
+    format_value(out, value);
+}
+
+template <typename T>
+void write_value(Buffer &out, Spec const &spec, T const &value)
+{
+    write_kind(out, spec, value, KindOf<T>());
+}
+
+struct Argument
+{
+    const void *value;
+    void (*write)(Buffer &, Spec const &, const void *);
+};
+
+template <typename T>
+void write_argument(Buffer &out, Spec const &spec, const void *value)
+{
+    write_value(out, spec, *static_cast<T const *>(value));
+}
+
+template <typename T>
+Argument make_argument(T const &value)
+{
+    return {&value, &write_argument<T>};
+}
+
+void format_segments(Buffer &out, Segment const *segments, size_t count, Argument const *arguments);
+
+template <size_t N, typename... Args>
+void format_to(Buffer &out, Compiled<N> const &compiled, Args const &... args)
+{
+    const Argument arguments[] = {make_argument(args)..., Argument{}};
+    format_segments(out, compiled.segments, compiled.count, arguments);
+}
+
+} // namespace fmt
+
+// Evaluates nothing; fails to compile if the placeholders in FMT don't match
+// the arguments that follow it.
+#define FORMAT_CHECK(FMT, ...)                                                                     \
+    static_assert(::fmt::check(FMT, decltype(::fmt::types(__VA_ARGS__)){}) !=                      \
+                      ::fmt::Error::malformed_placeholder,                                         \
+                  "malformed format placeholder");                                                 \
+    static_assert(::fmt::check(FMT, decltype(::fmt::types(__VA_ARGS__)){}) !=                      \
+                      ::fmt::Error::too_few_arguments,                                             \
+                  "too few arguments for format string");                                          \
+    static_assert(::fmt::check(FMT, decltype(::fmt::types(__VA_ARGS__)){}) !=                      \
+                      ::fmt::Error::too_many_arguments,                                            \
+                  "too many arguments for format string");                                         \
+    static_assert(::fmt::check(FMT, decltype(::fmt::types(__VA_ARGS__)){}) !=                      \
+                      ::fmt::Error::type_mismatch,                                                 \
+                  "format conversion does not match argument type")
+
+#define FORMAT_TO(BUFFER, FMT, ...)                                                                \
+    do                                                                                             \
+    {                                                                                              \
+        FORMAT_CHECK(FMT, ##__VA_ARGS__);                                                          \
+        static constexpr auto format_compiled_ = ::fmt::compile<::fmt::count_segments(FMT)>(FMT);  \
+        ::fmt::format_to(BUFFER, format_compiled_, ##__VA_ARGS__);                                 \
+    } while (0)
+
+#define FORMAT(FMT, ...)                                                                           \
+    ([&] {                                                                                         \
+        ::fmt::StackBuffer<1024> format_buffer_;                                                   \
+        FORMAT_TO(format_buffer_, FMT, ##__VA_ARGS__);                                             \
+        return format_buffer_.str();                                                               \
+    }())
@@ -0,0 +1,304 @@
+#include "log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace logging
+{
+
+std::atomic<int> runtime_level(LOG_COMPILE_LEVEL);
+
+namespace
+{
+
+const size_t RING_CAPACITY = 128; // records per thread, power of two
+const size_t RECORD_TEXT = MAX_MESSAGE;
+
+struct Record
+{
+    Level level;
+    const char *file;
+    int line;
+    size_t length;
+    char text[RECORD_TEXT];
+};
+
+// Single-producer, single-consumer ring owned jointly by one logging thread
+// and the writer thread. The producer only advances head, the consumer only
+// advances tail.
+struct Ring
+{
+    Record records[RING_CAPACITY];
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+    std::atomic<bool> orphaned{false};
+};
+
+std::terminate_handler previous_terminate;
+void flush_and_terminate();
+
+class Writer
+{
+public:
+    Writer()
+        : _thread([this] { run(); })
+    {
+        previous_terminate = std::set_terminate(flush_and_terminate);
+    }
+
+    ~Writer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _wake.notify_one();
+        _thread.join();
+        close_output();
+    }
+
+    void add(std::shared_ptr<Ring> const &ring)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _rings.push_back(ring);
+    }
+
+    void notify()
+    {
+        if (_idle.load(std::memory_order_relaxed))
+        {
+            _wake.notify_one();
+        }
+    }
+
+    bool set_output(std::string const &path)
+    {
+        FILE *file = stderr;
+        if (!path.empty())
+        {
+            file = std::fopen(path.c_str(), "a");
+            if (!file)
+            {
+                return false;
+            }
+        }
+        std::lock_guard<std::mutex> lock(_output_mutex);
+        close_output();
+        _output = file;
+        return true;
+    }
+
+    void flush()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto ticket = ++_requested;
+        _wake.notify_one();
+        _flushed.wait(lock, [&] { return _completed >= ticket || _stopping; });
+    }
+
+private:
+    void run()
+    {
+        std::vector<std::shared_ptr<Ring>> rings;
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (;;)
+        {
+            rings = _rings;
+            auto stopping = _stopping;
+            auto serving = _requested;
+            lock.unlock();
+
+            size_t drained = 0;
+            for (auto &ring : rings)
+            {
+                drained += drain(*ring);
+            }
+            {
+                std::lock_guard<std::mutex> output_lock(_output_mutex);
+                std::fflush(_output);
+            }
+
+            lock.lock();
+            _completed = serving;
+            _flushed.notify_all();
+            if (stopping)
+            {
+                return;
+            }
+            _rings.erase(std::remove_if(_rings.begin(), _rings.end(), [](std::shared_ptr<Ring> const &ring) {
+                return ring->orphaned.load(std::memory_order_acquire) &&
+                       ring->head.load(std::memory_order_acquire) == ring->tail.load(std::memory_order_relaxed);
+            }), _rings.end());
+            if (drained == 0 && _requested == _completed)
+            {
+                _idle.store(true, std::memory_order_relaxed);
+                _wake.wait_for(lock, std::chrono::milliseconds(50));
+                _idle.store(false, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    size_t drain(Ring &ring)
+    {
+        static const char *const NAMES = "viwe";
+        auto tail = ring.tail.load(std::memory_order_relaxed);
+        auto head = ring.head.load(std::memory_order_acquire);
+        std::lock_guard<std::mutex> output_lock(_output_mutex);
+        for (auto i = tail; i != head; ++i)
+        {
+            auto &record = ring.records[i & (RING_CAPACITY - 1)];
+            std::fprintf(_output, "%c:%s %d: %.*s\n", NAMES[(int)record.level], record.file, record.line,
+                         (int)record.length, record.text);
+        }
+        ring.tail.store(head, std::memory_order_release);
+        return head - tail;
+    }
+
+    void close_output()
+    {
+        if (_output != stderr)
+        {
+            std::fclose(_output);
+        }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _flushed;
+    std::vector<std::shared_ptr<Ring>> _rings;
+    bool _stopping = false;
+    unsigned long _requested = 0;
+    unsigned long _completed = 0;
+    std::atomic<bool> _idle{false};
+
+    std::mutex _output_mutex;
+    FILE *_output = stderr;
+
+    std::thread _thread;
+};
+
+// Uncaught exceptions skip static destructors, so drain whatever was queued
+// (typically the loge() that preceded the throw) before aborting.
+void flush_and_terminate()
+{
+    flush();
+    if (previous_terminate)
+    {
+        previous_terminate();
+    }
+    std::abort();
+}
+
+Writer &writer()
+{
+    static Writer instance;
+    return instance;
+}
+
+// Registers the calling thread's ring with the writer on first use and hands
+// it over for a final drain when the thread exits.
+struct ThreadRing
+{
+    ThreadRing()
+        : ring(std::make_shared<Ring>())
+    {
+        writer().add(ring);
+    }
+
+    ~ThreadRing()
+    {
+        ring->orphaned.store(true, std::memory_order_release);
+    }
+
+    std::shared_ptr<Ring> ring;
+};
+
+} // namespace
+
+void set_level(Level level)
+{
+    runtime_level.store((int)level, std::memory_order_relaxed);
+}
+
+bool parse_level(const char *name, Level &out)
+{
+    static const struct
+    {
+        const char *name;
+        Level level;
+    } LEVELS[] = {
+        {"verbose", Level::verbose},
+        {"info", Level::info},
+        {"warning", Level::warning},
+        {"error", Level::error},
+        {"none", Level::none},
+    };
+    for (auto &entry : LEVELS)
+    {
+        if (std::strcmp(name, entry.name) == 0 || (name[0] == entry.name[0] && name[1] == '\0'))
+        {
+            out = entry.level;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool set_output(std::string const &path)
+{
+    return writer().set_output(path);
+}
+
+void configure_from_environment()
+{
+    Level level;
+    if (auto name = std::getenv("SES2ALS_LOG_LEVEL"))
+    {
+        if (parse_level(name, level))
+        {
+            set_level(level);
+        }
+    }
+    if (auto path = std::getenv("SES2ALS_LOG_FILE"))
+    {
+        set_output(path);
+    }
+}
+
+void write(Level level, const char *file, int line, const char *message, size_t length)
+{
+    thread_local ThreadRing thread_ring;
+    auto &ring = *thread_ring.ring;
+
+    auto head = ring.head.load(std::memory_order_relaxed);
+    while (head - ring.tail.load(std::memory_order_acquire) == RING_CAPACITY)
+    {
+        // Full: apply backpressure rather than drop records.
+        writer().notify();
+        std::this_thread::yield();
+    }
+
+    auto &record = ring.records[head & (RING_CAPACITY - 1)];
+    record.level = level;
+    record.file = file;
+    record.line = line;
+    record.length = std::min(length, RECORD_TEXT);
+    std::memcpy(record.text, message, record.length);
+    ring.head.store(head + 1, std::memory_order_release);
+    writer().notify();
+}
+
+void flush()
+{
+    writer().flush();
+}
+
+} // namespace logging
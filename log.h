@@ -1,65 +1,119 @@
 #pragma once
 
+#include "format.h"
+
+#include <atomic>
 #include <cassert>
-#include <cstdio>
-#include <iostream>
-#include <sstream>
+#include <exception>
+#include <memory>
+#include <string>
+
+// Severity levels, lowest first. Records below LOG_COMPILE_LEVEL are compiled
+// out entirely, so neither their arguments nor their formatting are evaluated.
+#define LOG_LEVEL_VERBOSE 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE 4
 
-template<size_t N>
-std::ostream &operator<<(std::ostream &os, char s[N])
+#ifndef LOG_COMPILE_LEVEL
+#if LOG
+#define LOG_COMPILE_LEVEL LOG_LEVEL_VERBOSE
+#else
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#endif
+#endif
+
+namespace logging
 {
-    for (auto &c : s)
-    {
-        os << c;
-    }
-    return os;
-}
 
-inline void format(std::ostream &os, const char *fmt)
+enum class Level
 {
-    os << fmt;
-}
+    verbose = LOG_LEVEL_VERBOSE,
+    info = LOG_LEVEL_INFO,
+    warning = LOG_LEVEL_WARNING,
+    error = LOG_LEVEL_ERROR,
+    none = LOG_LEVEL_NONE,
+};
+
+// Longer messages are truncated.
+const size_t MAX_MESSAGE = 1000;
+
+extern std::atomic<int> runtime_level;
 
-template <typename T, typename... Args>
-inline void format(std::ostream &os, const char *fmt, T const &value, Args const &... args)
+inline bool enabled(Level level)
 {
-    while (*fmt)
-    {
-        if (*fmt == '%')
-        {
-            if (fmt[1] == '%')
-            {
-                ++fmt;
-            }
-            else
-            {
-                // TODO: %x, %02d, etc.
-                os << value;
-                fmt += 2;
-                format(os, fmt, args...);
-                return;
-            }
-        }
-        os << *fmt;
-        ++fmt;
-    }
+    return (int)level >= runtime_level.load(std::memory_order_relaxed);
 }
 
-#define log_(category, ...)                               \
-    std::printf(category ":%s %d: ", __FILE__, __LINE__); \
-    format(std::cout, __VA_ARGS__);                       \
-    std::printf("\n")
-
-#define logv(...) log_("v", __VA_ARGS__)
-#define logi(...) log_("i", __VA_ARGS__)
-#define logw(...) log_("w", __VA_ARGS__)
-#define loge(...) log_("e", __VA_ARGS__)
-
-#define ASSERT(EXPRESSION, ...) \
-    if (!(EXPRESSION))          \
-    {                           \
-        loge(__VA_ARGS__);      \
-        assert(false);          \
+void set_level(Level level);
+
+// Parses "verbose", "info", "warning", "error" or "none" (or their first letter).
+bool parse_level(const char *name, Level &out);
+
+// Records go to stderr unless an output file is set. An empty path restores stderr.
+bool set_output(std::string const &path);
+
+// Reads SES2ALS_LOG_LEVEL and SES2ALS_LOG_FILE.
+void configure_from_environment();
+
+// Queues a formatted record on the calling thread's ring buffer. The
+// background writer adds the level and source location prefix.
+void write(Level level, const char *file, int line, const char *message, size_t length);
+
+// Blocks until every record queued so far has been written out.
+void flush();
+
+} // namespace logging
+
+#define log_(level, FMT, ...)                                                               \
+    do                                                                                         \
+    {                                                                                          \
+        if (::logging::enabled(level))                                                         \
+        {                                                                                      \
+            ::fmt::StackBuffer<::logging::MAX_MESSAGE> log_buffer_;                            \
+            FORMAT_TO(log_buffer_, FMT, ##__VA_ARGS__);                                        \
+            ::logging::write(level, __FILE__, __LINE__, log_buffer_.data(), log_buffer_.size()); \
+        }                                                                                      \
+    } while (0)
+
+// Compiled-out levels still have their format strings checked.
+#define log_disabled_(FMT, ...)                \
+    do                                         \
+    {                                          \
+        FORMAT_CHECK(FMT, ##__VA_ARGS__);      \
+    } while (0)
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_VERBOSE
+#define logv(...) log_(::logging::Level::verbose, __VA_ARGS__)
+#else
+#define logv(...) log_disabled_(__VA_ARGS__)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_INFO
+#define logi(...) log_(::logging::Level::info, __VA_ARGS__)
+#else
+#define logi(...) log_disabled_(__VA_ARGS__)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_WARNING
+#define logw(...) log_(::logging::Level::warning, __VA_ARGS__)
+#else
+#define logw(...) log_disabled_(__VA_ARGS__)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_ERROR
+#define loge(...) log_(::logging::Level::error, __VA_ARGS__)
+#else
+#define loge(...) log_disabled_(__VA_ARGS__)
+#endif
+
+#define ASSERT(EXPRESSION, ...)  \
+    if (!(EXPRESSION))           \
+    {                            \
+        loge(__VA_ARGS__);       \
+        ::logging::flush();      \
+        assert(false);           \
     }
 
 class exception : public std::exception
@@ -67,20 +121,20 @@ class exception : public std::exception
 public:
     virtual ~exception() noexcept override = default;
 
-    template <typename... T>
-    exception(const char *fmt, T const &... args)
-        : _ss(new std::stringstream)
+    explicit exception(std::string message)
+        : _message(std::make_shared<std::string>(std::move(message)))
     {
-        format(*_ss, fmt, args...);
     }
 
 public:
     const char *what() const noexcept override
     {
-        return _ss->str().c_str();
+        return _message->c_str();
     }
 
 protected:
-    std::shared_ptr<std::stringstream> _ss;
+    // Shared so that copying the exception while it is thrown cannot throw.
+    std::shared_ptr<const std::string> _message;
 };
 
+#define THROW(...) throw exception(FORMAT(__VA_ARGS__))
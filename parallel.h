@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+inline unsigned default_thread_count()
+{
+    auto count = std::thread::hardware_concurrency();
+    return count ? count : 1;
+}
+
+// Calls fn(i) for every i in [0, count) on up to `threads` workers, zero
+// meaning one per hardware thread. Indices are handed out one at a time, so
+// uneven work balances itself. The first exception thrown by fn is rethrown
+// once every worker has stopped.
+template <typename F>
+void parallel_for(size_t count, F const &fn, unsigned threads = 0)
+{
+    if (threads == 0)
+    {
+        threads = default_thread_count();
+    }
+    threads = (unsigned)std::min<size_t>(threads, count);
+    if (threads <= 1)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            fn(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto work = [&] {
+        for (size_t i; !failed.load(std::memory_order_relaxed) && (i = next++) < count;)
+        {
+            try
+            {
+                fn(i);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (unsigned i = 1; i < threads; ++i)
+    {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
@@ -1,26 +1,40 @@
+#include "Gain.h"
+#include "Mix.h"
+#include "Resample.h"
+#include "SampleIndex.h"
+#include "SampleLibrary.h"
+#include "SessionCatalog.h"
 #include "SessionFile.h"
+#include "Takes.h"
+#include "Timeline.h"
+#include "WaveFile.h"
 #include "log.h"
+#include "parallel.h"
+#include "xml.h"
 #include "json.hpp"
 
+#include <dirent.h>
 #include <libgen.h>
+#include <sys/stat.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <sstream>
 #include <streambuf>
 #include <string>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 
-namespace
-{
-#if LOG
-auto &logger = std::cerr;
-#else
-std::ofstream logger;
-#endif
-} // namespace
-
 using namespace CoolEdit;
 
 /*
@@ -34,6 +48,7 @@ Keys to replace:
 
     AudioTrack
       __ID__
+      __USER_NAME__
       __PAN__
       __VOLUME__
       __MUTE__
@@ -52,6 +67,10 @@ Keys to replace:
       __NAME__
       __COLOR_INDEX__
       __SAMPLE_FILE_NAME__
+      __SAMPLE_FILE_SIZE__
+      __SAMPLE_DEFAULT_DURATION__
+      __SAMPLE_DEFAULT_SAMPLE_RATE__
+      __SAMPLE_VOLUME__
 */
 
 std::string load_string(std::string const &path)
@@ -59,7 +78,7 @@ std::string load_string(std::string const &path)
     std::ifstream in(path, std::ios::in|std::ios::ate);
     if (!in.good())
     {
-        throw exception("Unable to open file: %@", path);
+        THROW("Unable to open file: %@", path);
     }
     std::string result;
     result.reserve(in.tellg());
@@ -68,149 +87,1344 @@ std::string load_string(std::string const &path)
     return result;
 }
 
+// Strips the whitespace between elements and inside tags that XML ignores, so
+// that every copy of the template is smaller to fill in and to write out.
+// Placeholders between elements are kept. All XML is made from the templates,
+// so the project comes out minified too.
+std::string minify_template(std::string const &xml)
+{
+    const char *SPACE = " \t\r\n";
+    std::string out;
+    out.reserve(xml.size());
+    size_t i = 0;
+    while (i < xml.size())
+    {
+        auto tag = std::min(xml.find('<', i), xml.size());
+        auto first = xml.find_first_not_of(SPACE, i);
+        if (first < tag)
+        {
+            auto last = xml.find_last_not_of(SPACE, tag - 1);
+            out.append(xml, first, last + 1 - first);
+        }
+        if (tag == xml.size())
+        {
+            break;
+        }
+
+        char quote = 0;
+        for (i = tag; i < xml.size(); ++i)
+        {
+            auto c = xml[i];
+            if (quote)
+            {
+                out += c;
+                quote = c == quote ? 0 : quote;
+            }
+            else if (c == '"' || c == '\'')
+            {
+                out += c;
+                quote = c;
+            }
+            else if (std::strchr(SPACE, c))
+            {
+                // Runs of whitespace become one space, or none before the end
+                // of the tag.
+                auto next = xml.find_first_not_of(SPACE, i);
+                if (next != std::string::npos && !std::strchr("/?>", xml[next]))
+                {
+                    out += ' ';
+                }
+                i = std::min(next, xml.size()) - 1;
+            }
+            else
+            {
+                out += c;
+                if (c == '>')
+                {
+                    break;
+                }
+            }
+        }
+        ++i;
+    }
+    return out;
+}
+
 std::string ABLETON_XML, AUDIO_CLIP_XML, AUDIO_TRACK_XML;
 
-void replace(std::string &out, std::string const &key, std::string const &value)
+// Directory of the session being converted, where its samples are expected
+// unless found elsewhere.
+std::string SESSION_DIR;
+
+// Samples found by the sample index, by wave id.
+std::unordered_map<unsigned, std::string> SOURCE_SAMPLES;
+
+WaveFile::ProbeCache WAVE_PROBES;
+
+// Samples this run wrote for the project (resampled or consolidated), by wave
+// id, and where they were written.
+std::unordered_map<unsigned, std::string> WRITTEN_SAMPLES;
+
+// The name of every sample in the project, by its path. The project keeps its
+// samples in one directory, so files of the same name from different
+// directories are told apart by a number, see claim_project_name.
+std::unordered_map<std::string, std::string> PROJECT_NAMES;
+
+// Lowercase, as the project may end up on a file system ignoring case.
+std::set<std::string> TAKEN_PROJECT_NAMES;
+
+// Whether block volumes end up in the project, see bake_gains.
+bool APPLY_BLOCK_GAIN = false;
+
+// Highest clip gain Live accepts, +24 dB.
+const double MAX_SAMPLE_VOLUME = 15.848931924611133;
+
+// Inserts value as it is, for XML fragments and text already escaped.
+void replace_raw(std::string &out, std::string const &key, std::string const &value)
 {
-    logger << "Replace " << key << '\n';
+    logv("Replace %@", key);
     auto pos = out.find(key);
     if (pos == std::string::npos)
     {
-        throw exception("Key not found in string: %@", key);
+        THROW("Key not found in string: %@", key);
     }
     out.replace(pos, key.length(), value);
 }
 
+// Strings always go into attribute values.
+void replace(std::string &out, std::string const &key, std::string const &value)
+{
+    replace_raw(out, key, xml::escape_attribute(value));
+}
+
 template<typename T>
 void replace(std::string &out, std::string const &key, T const &value)
 {
-    logger << "Replace T " << key << '\n';
+    logv("Replace T %@", key);
     std::stringstream ss;
+    ss.precision(15);
     ss << value;
-    replace(out, key, ss.str());
+    replace_raw(out, key, ss.str());
 }
 
 void replace(std::string &out, std::string const &key, bool value)
 {
-    logger << "Replace bool " << key << '\n';
-    replace(out, key, value ? "true" : "false");
+    logv("Replace bool %@", key);
+    replace_raw(out, key, value ? "true" : "false");
 }
 
-double samples_to_seconds(Session const &session, unsigned samples)
+std::string get_wave_filename(Wave const &wave)
 {
-    return samples / (double)session.sample_rate;
+    auto &name = wave.filename;
+    return name.substr(name.rfind("\\") + 1); // Absolute windows path with backslashes. Just strip off the DIRNAME and hope the file will be located near the als project
 }
 
-double seconds_to_beats(Session const &session, double seconds)
+Wave const *find_wave(Session const &session, unsigned id)
 {
-    return seconds * (session.tempo.beats_per_minute / 60.0);
+    auto it = find_if(session.waves.begin(), session.waves.end(), [&](Wave const &wave)
+    {
+        return wave.id == id;
+    });
+    return it != session.waves.end() ? &*it : nullptr;
+}
+
+Wave const &get_wave(Session const &session, Block const &block)
+{
+    auto wave = find_wave(session, block.wave_id);
+    if (!wave)
+    {
+        THROW("Invalid wave: %@ for block %@", block.wave_id, block.id);
+    }
+    return *wave;
 }
 
 std::string get_wave_filename(Session const &session, Block const &block)
 {
-    auto it = find_if(session.waves.begin(), session.waves.end(), [&](Wave const &wave)
+    return get_wave_filename(get_wave(session, block));
+}
+
+// Leaves only the active take of every punch-in region in place. The other
+// takes are dropped or, with keep_alternates, moved to muted tracks after the
+// session's own: the n-th newest alternate of a region goes to the n-th take
+// track of the region's track.
+void resolve_takes(Session &session, bool keep_alternates)
+{
+    TakeGraph takes(session);
+    if (takes.chains().empty())
     {
-        return wave.id == block.wave_id;
-    });
-    if (it == session.waves.end())
+        return;
+    }
+
+    std::map<std::pair<unsigned, size_t>, unsigned> take_tracks;
+    for (auto &chain : takes.chains())
     {
-        throw exception("Invalid wave: %@ for block %@", block.wave_id, block.id);
+        for (size_t rank = 1; rank < chain.size(); ++rank)
+        {
+            take_tracks[{session.blocks[chain[rank]].track, rank}] = 0;
+        }
     }
-    auto &name = it->filename;
-    return name.substr(name.rfind("\\") + 1); // Absolute windows path with backslashes. Just strip off the DIRNAME and hope the file will be located near the als project
+    if (keep_alternates)
+    {
+        // Take tracks are appended below, and copy only the session's own.
+        auto track_count = session.tracks.size();
+        for (auto &entry : take_tracks)
+        {
+            auto number = entry.first.first;
+            Track track{1.0, 1.0, "", true};
+            if (number >= 1 && number <= track_count)
+            {
+                track.left_volume = session.tracks[number - 1].left_volume;
+                track.right_volume = session.tracks[number - 1].right_volume;
+                track.title = session.tracks[number - 1].title;
+            }
+            track.title = FORMAT("%@ (take %@)", track.title, entry.first.second);
+            session.tracks.push_back(std::move(track));
+            entry.second = (unsigned)session.tracks.size();
+        }
+    }
+
+    size_t alternates = 0;
+    for (auto &chain : takes.chains())
+    {
+        for (size_t rank = 1; rank < chain.size(); ++rank)
+        {
+            auto &block = session.blocks[chain[rank]];
+            if (keep_alternates)
+            {
+                block.track = take_tracks[{block.track, rank}];
+            }
+            ++alternates;
+        }
+    }
+    if (!keep_alternates)
+    {
+        std::vector<Block> blocks;
+        for (size_t i = 0; i < session.blocks.size(); ++i)
+        {
+            if (!takes.is_alternate(i))
+            {
+                blocks.push_back(session.blocks[i]);
+            }
+        }
+        session.blocks.swap(blocks);
+    }
+    logi("Punch-ins: kept the active take of %@ regions, %@ alternate takes %@", takes.chains().size(), alternates,
+         keep_alternates ? "moved to muted tracks" : "left out");
 }
 
-double get_warp_sec(Session const &session, double seconds)
+// Where the session's own sample for a wave lives.
+std::string get_source_path(Wave const &wave)
 {
-    auto beats = seconds_to_beats(session, seconds);
-    return beats * session.tempo.beats_per_minute;
+    auto it = SOURCE_SAMPLES.find(wave.id);
+    return it != SOURCE_SAMPLES.end() ? it->second : SESSION_DIR + "/" + get_wave_filename(wave);
 }
 
-double get_warp_beat(Session const &session, double seconds)
+// Where the sample the project will play for a wave lives.
+std::string get_sample_path(Wave const &wave)
 {
-    return get_warp_sec(session, seconds) * (session.tempo.beats_per_minute / 60.0);
+    auto it = WRITTEN_SAMPLES.find(wave.id);
+    return it != WRITTEN_SAMPLES.end() ? it->second : get_source_path(wave);
 }
 
-std::string generate_audio_clips_xml(Session const &session, size_t track_index)
+std::string get_sample_path(Session const &session, Block const &block)
 {
-    std::string result;
+    return get_sample_path(get_wave(session, block));
+}
+
+std::string get_basename(std::string const &path)
+{
+    return path.substr(path.rfind('/') + 1);
+}
+
+// `filename` with `suffix` put before its extension, a .wav one if it has
+// none.
+std::string add_suffix(std::string const &filename, std::string const &suffix)
+{
+    auto dot = filename.rfind('.');
+    auto extension = dot == std::string::npos ? ".wav" : filename.substr(dot);
+    return filename.substr(0, dot) + suffix + extension;
+}
+
+// Names the file at `path` in the project: `name` if no other file has it
+// yet, else `name` numbered ("take 2.wav"). A path keeps the name it got
+// first.
+std::string claim_project_name(std::string const &path, std::string const &name)
+{
+    auto it = PROJECT_NAMES.find(path);
+    if (it != PROJECT_NAMES.end())
+    {
+        return it->second;
+    }
+    auto unique = name;
+    for (unsigned number = 2;; ++number)
+    {
+        auto lowercase = unique;
+        std::transform(lowercase.begin(), lowercase.end(), lowercase.begin(), ::tolower);
+        if (TAKEN_PROJECT_NAMES.insert(lowercase).second)
+        {
+            break;
+        }
+        unique = add_suffix(name, FORMAT(" %@", number));
+    }
+    PROJECT_NAMES.emplace(path, unique);
+    return unique;
+}
+
+// The name the file at `path` has in the project, its own if it was never
+// claimed.
+std::string get_project_name(std::string const &path)
+{
+    auto it = PROJECT_NAMES.find(path);
+    return it != PROJECT_NAMES.end() ? it->second : get_basename(path);
+}
+
+// Where a session's samples are, by wave id.
+struct ResolvedSamples
+{
+    std::unordered_map<unsigned, std::string> paths;
+    std::vector<std::string> missing; // wave paths as in the session
+    size_t shared;                    // waves sharing another wave's identical file
+};
+
+// Looks every wave up in `index`, normally the session's directory followed by
+// the shared roots. Waves whose library files have the same contents share
+// one of them. Safe to call from several threads at once.
+ResolvedSamples resolve_samples(Session const &session, SampleIndex const &index, SampleLibrary const *library)
+{
+    ResolvedSamples result{};
+    // The first file seen by size and content hash.
+    std::map<std::pair<uint64_t, uint64_t>, std::string> contents;
+    for (auto &wave : session.waves)
+    {
+        auto path = index.resolve(wave.filename);
+        if (path.empty())
+        {
+            result.missing.push_back(wave.filename);
+            continue;
+        }
+        SampleLibrary::Record record;
+        if (library && library->lookup(path, record) && is_current(record))
+        {
+            WAVE_PROBES.put(path, record.info);
+            // Files that could not be read have no hash to compare.
+            auto first = record.hashed ? contents.emplace(std::make_pair(record.size, record.hash), path).first->second
+                                       : path;
+            if (first != path)
+            {
+                path = first;
+                ++result.shared;
+            }
+        }
+        result.paths.emplace(wave.id, path);
+    }
+    return result;
+}
+
+// The shared sample roots, listed now or read from the library index at
+// `library_path` if there is one.
+std::unique_ptr<SampleLibrary> index_roots(SampleIndex &index, std::vector<std::string> const &roots,
+                                           std::string const &library_path)
+{
+    std::unique_ptr<SampleLibrary> library;
+    if (library_path.empty())
+    {
+        for (auto &root : roots)
+        {
+            index.add_root(root, true);
+        }
+    }
+    else
+    {
+        library.reset(new SampleLibrary(library_path, roots));
+        index.add_library(*library);
+    }
+    return library;
+}
+
+// Resolves the session's samples into SOURCE_SAMPLES and names them in the
+// project, in wave order so that every run names them alike, and reports the
+// ones that are nowhere to be found before any work starts.
+void find_samples(Session const &session, std::vector<std::string> const &roots, std::string const &library_path)
+{
+    SampleIndex shared;
+    auto library = index_roots(shared, roots, library_path);
+    SampleIndex index;
+    index.add_root(SESSION_DIR, false);
+    index.add_index(shared);
+    auto resolved = resolve_samples(session, index, library.get());
+    SOURCE_SAMPLES = std::move(resolved.paths);
+    for (auto &wave : session.waves)
+    {
+        auto path = get_source_path(wave);
+        claim_project_name(path, get_basename(path));
+    }
+    logi("Found %@ of %@ waves among %@ files", session.waves.size() - resolved.missing.size(),
+         session.waves.size(), index.size());
+    if (resolved.shared)
+    {
+        logi("%@ waves are copies of other waves' samples and share them", resolved.shared);
+    }
+    for (auto &filename : resolved.missing)
+    {
+        logw("Sample not found: %@", filename);
+    }
+}
+
+// Converts every wave whose rate differs from the session's into
+// `output_dir`, one file per worker. Waves that fail to convert keep
+// pointing at the original. Converted files keep their project name, so that
+// in the project's sample directory they replace the copies of the originals.
+void resample_waves(Session const &session, std::string const &output_dir)
+{
+    std::vector<std::string> sources;
+    for (auto &wave : session.waves)
+    {
+        auto source = get_source_path(wave);
+        auto &info = WAVE_PROBES.get(source);
+        if (info.valid && info.sample_rate != session.sample_rate &&
+            find(sources.begin(), sources.end(), source) == sources.end())
+        {
+            sources.push_back(source);
+        }
+    }
+
+    std::vector<char> converted(sources.size());
+    parallel_for(sources.size(), [&](size_t i)
+    {
+        try
+        {
+            Resample::convert_file(sources[i], output_dir + "/" + get_project_name(sources[i]),
+                                   session.sample_rate);
+            converted[i] = true;
+        }
+        catch (std::exception const &e)
+        {
+            logw("Cannot resample %@: %@", sources[i], e.what());
+        }
+    });
+
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        if (!converted[i])
+        {
+            continue;
+        }
+        auto name = get_project_name(sources[i]);
+        auto path = output_dir + "/" + name;
+        PROJECT_NAMES.emplace(path, name);
+        for (auto &wave : session.waves)
+        {
+            if (get_source_path(wave) == sources[i])
+            {
+                WRITTEN_SAMPLES[wave.id] = path;
+            }
+        }
+        paths.push_back(path);
+    }
+    WAVE_PROBES.probe_all(paths);
+    logi("Resampled %@ of %@ samples to %@ Hz", paths.size(), sources.size(), session.sample_rate);
+}
+
+// A stretch of one wave used by at least one block, in session samples.
+struct Region
+{
+    unsigned source_id; // of the wave it is a stretch of
+    unsigned start;
+    unsigned end;
+    unsigned wave_id;     // of the trimmed copy
+    std::string filename; // of the trimmed copy
+};
+
+// Replaces every wave with trimmed copies of just the regions its blocks
+// use, merged where they overlap, written to `output_dir`. Blocks are moved
+// onto the copies with their wave offsets rebased. Waves whose rate differs
+// from the session's are left alone, as are blocks reaching past the end of
+// their wave.
+void consolidate_waves(Session &session, std::string const &output_dir)
+{
+    std::map<unsigned, std::vector<Region>> used;
     for (auto &block : session.blocks)
     {
-        if (block.track != track_index)
+        auto &wave = get_wave(session, block);
+        used[wave.id].push_back(
+            {wave.id, block.wave_offset_samples, block.wave_offset_samples + block.size_samples, 0, ""});
+    }
+
+    unsigned next_id = 0;
+    for (auto &wave : session.waves)
+    {
+        next_id = std::max(next_id, wave.id + 1);
+    }
+    std::vector<Region> regions;
+    for (auto &entry : used)
+    {
+        auto &wave = *find_wave(session, entry.first);
+        auto source = get_sample_path(wave);
+        auto &info = WAVE_PROBES.get(source);
+        if (!info.valid || info.sample_rate != session.sample_rate)
+        {
+            logw("Not consolidating %@: %@", wave.filename,
+                 info.valid ? "sample rate differs from the session's, use --resample" : "unreadable");
+            continue;
+        }
+        auto &ranges = entry.second;
+        sort(ranges.begin(), ranges.end(), [](Region const &a, Region const &b) { return a.start < b.start; });
+        auto merged = ranges.begin();
+        for (auto it = ranges.begin() + 1; it < ranges.end(); ++it)
+        {
+            if (it->start <= merged->end)
+            {
+                merged->end = std::max(merged->end, it->end);
+            }
+            else
+            {
+                *++merged = *it;
+            }
+        }
+        ranges.erase(merged + 1, ranges.end());
+        for (auto &range : ranges)
+        {
+            if (range.end > info.frames)
+            {
+                logw("Not consolidating %@ from %@ to %@: past the end of the sample", wave.filename, range.start,
+                     range.end);
+                continue;
+            }
+            range.wave_id = next_id++;
+            auto name = add_suffix(get_project_name(source), FORMAT(" %@-%@", range.start, range.end));
+            range.filename = claim_project_name(output_dir + "/" + name, name);
+            regions.push_back(range);
+        }
+    }
+
+    // The sources by wave id, before the copies join session.waves.
+    std::unordered_map<unsigned, std::string> sources;
+    for (auto &wave : session.waves)
+    {
+        sources.emplace(wave.id, get_sample_path(wave));
+    }
+    std::vector<char> written(regions.size());
+    parallel_for(regions.size(), [&](size_t i)
+    {
+        auto &region = regions[i];
+        auto &source = sources.at(region.source_id);
+        try
+        {
+            WaveFile::extract(WAVE_PROBES.get(source), source, output_dir + "/" + region.filename, region.start,
+                              region.end - region.start);
+            written[i] = true;
+        }
+        catch (std::exception const &e)
+        {
+            logw("Cannot consolidate %@: %@", source, e.what());
+        }
+    });
+
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < regions.size(); ++i)
+    {
+        auto &region = regions[i];
+        if (!written[i])
         {
             continue;
         }
+        WRITTEN_SAMPLES[region.wave_id] = output_dir + "/" + region.filename;
+        paths.push_back(output_dir + "/" + region.filename);
+        session.waves.push_back({region.wave_id, region.filename});
+        for (auto &block : session.blocks)
+        {
+            if (block.wave_id == region.source_id && block.wave_offset_samples >= region.start &&
+                block.wave_offset_samples + block.size_samples <= region.end)
+            {
+                block.wave_id = region.wave_id;
+                block.wave_offset_samples -= region.start;
+            }
+        }
+    }
+    WAVE_PROBES.probe_all(paths);
+    uint64_t size = 0;
+    for (auto &path : paths)
+    {
+        size += WAVE_PROBES.get(path).file_size;
+    }
+    logi("Consolidated %@ regions into %@ bytes of samples", paths.size(), size);
+}
+
+// Whether Live can play a block's volumes as plain clip gain.
+bool is_clip_gain(Block const &block)
+{
+    return block.left_volume == block.right_volume && block.left_volume >= 0 &&
+           block.left_volume <= MAX_SAMPLE_VOLUME;
+}
+
+// Makes block volumes part of the project: as clip gain where Live can
+// express them, otherwise by rendering the block's part of its wave with
+// the volumes applied into `output_dir` and pointing the block there.
+void bake_gains(Session &session, std::string const &output_dir)
+{
+    APPLY_BLOCK_GAIN = true;
+    std::vector<size_t> rendered;
+    for (size_t i = 0; i < session.blocks.size(); ++i)
+    {
+        if (!is_clip_gain(session.blocks[i]))
+        {
+            rendered.push_back(i);
+        }
+    }
 
+    auto next_id = 0u;
+    for (auto &wave : session.waves)
+    {
+        next_id = std::max(next_id, wave.id + 1);
+    }
+    std::vector<std::string> sources, filenames;
+    for (auto i : rendered)
+    {
+        auto &block = session.blocks[i];
+        sources.push_back(get_sample_path(session, block));
+        auto name = add_suffix(get_project_name(sources.back()), FORMAT(" block %@", block.id));
+        filenames.push_back(claim_project_name(output_dir + "/" + name, name));
+    }
+    std::vector<char> written(rendered.size());
+    parallel_for(rendered.size(), [&](size_t i)
+    {
+        auto &block = session.blocks[rendered[i]];
+        auto filename = get_wave_filename(session, block);
+        auto &source = sources[i];
+        auto &info = WAVE_PROBES.get(source);
+        if (info.valid && info.sample_rate != session.sample_rate)
+        {
+            logw("Cannot apply volume to block %@ of %@: sample rate differs from the session's, use --resample",
+                 block.id, filename);
+            return;
+        }
+        try
+        {
+            Gain::render(info, source, output_dir + "/" + filenames[i],
+                         block.wave_offset_samples, block.size_samples, (float)block.left_volume,
+                         (float)block.right_volume);
+            written[i] = true;
+        }
+        catch (std::exception const &e)
+        {
+            logw("Cannot apply volume to block %@ of %@: %@", block.id, filename, e.what());
+        }
+    });
+
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < rendered.size(); ++i)
+    {
+        if (!written[i])
+        {
+            continue;
+        }
+        auto &block = session.blocks[rendered[i]];
+        WRITTEN_SAMPLES[next_id] = output_dir + "/" + filenames[i];
+        paths.push_back(output_dir + "/" + filenames[i]);
+        session.waves.push_back({next_id, filenames[i]});
+        block.wave_id = next_id++;
+        block.wave_offset_samples = 0;
+        block.left_volume = block.right_volume = 1;
+    }
+    WAVE_PROBES.probe_all(paths);
+    logi("Rendered volumes of %@ of %@ blocks, the rest as clip gain", paths.size(), rendered.size());
+}
+
+// File name for a track's stem: its number, so that stems sort in track
+// order, and its title with characters file systems reject replaced.
+std::string get_stem_filename(Session const &session, size_t track_index)
+{
+    auto title = session.tracks[track_index].title;
+    for (auto &c : title)
+    {
+        if (c == '/' || c == '\\' || c == ':' || c == '*' || c == '?' || c == '"' || c == '<' || c == '>' ||
+            c == '|' || (unsigned char)c < 32)
+        {
+            c = '_';
+        }
+    }
+    return title.empty() ? FORMAT("%02@.wav", track_index + 1) : FORMAT("%02@ %@.wav", track_index + 1, title);
+}
+
+// How long the sample of each clip lasts.
+std::vector<double> get_wave_seconds(Session const &session, std::vector<Segment> const &clips)
+{
+    std::vector<double> seconds(clips.size());
+    for (size_t i = 0; i < clips.size(); ++i)
+    {
+        auto &clip = clips[i];
+        auto &info = WAVE_PROBES.get(get_sample_path(session, session.blocks[clip.block]));
+        // Without a readable header, the end of the used region is the best guess.
+        seconds[i] = info.valid ? info.duration_seconds()
+                                : (double)(clip.wave_offset + clip.end - clip.start) / session.sample_rate;
+    }
+    return seconds;
+}
+
+// XML for clips [begin, end), one track's.
+// `names` holds the escaped file name of every wave, by wave id.
+std::string generate_audio_clips_xml(Session const &session, std::vector<Segment> const &clips,
+                                     ClipTimes const &times, std::unordered_map<unsigned, std::string> const &names,
+                                     size_t begin, size_t end)
+{
+    std::string result;
+    for (auto i = begin; i < end; ++i)
+    {
+        auto &block = session.blocks[clips[i].block];
         auto xml = AUDIO_CLIP_XML;
         replace(xml, "__COLOR_INDEX__", 20);
 
-        auto start_seconds = samples_to_seconds(session, block.offset_samples);
-        auto start_beats = seconds_to_beats(session, start_seconds);
-        auto duration_seconds = samples_to_seconds(session, block.size_samples);
-        auto duration_beats = seconds_to_beats(session, duration_seconds);
-        replace(xml, "__TIME__", start_beats);
-        replace(xml, "__CURRENT_START__", start_beats);
-        replace(xml, "__CURRENT_END__", start_beats + duration_beats);
+        replace(xml, "__TIME__", times.start_beats[i]);
+        replace(xml, "__CURRENT_START__", times.start_beats[i]);
+        replace(xml, "__CURRENT_END__", times.end_beats[i]);
 
-        auto loop_start_sec = samples_to_seconds(session, block.wave_offset_samples);
-        replace(xml, "__LOOP_START__", loop_start_sec);
-        replace(xml, "__LOOP_END__", duration_beats);
+        replace(xml, "__LOOP_START__", times.loop_start_seconds[i]);
+        replace(xml, "__LOOP_END__", times.loop_end_seconds[i]);
 
-        // This isn't really right, but at least Live will fix it when Warp is enabled manually
+        // The whole sample at its own rate, mapped onto the session tempo.
         replace(xml, "__WARP_START_SEC_TIME__", 0);
         replace(xml, "__WARP_START_BEAT_TIME__", 0);
-        replace(xml, "__WARP_END_SEC_TIME__", 10000);
-        replace(xml, "__WARP_END_BEAT_TIME__", 10000);
+        replace(xml, "__WARP_END_SEC_TIME__", times.warp_end_seconds[i]);
+        replace(xml, "__WARP_END_BEAT_TIME__", times.warp_end_beats[i]);
 
-        auto filename = get_wave_filename(session, block);
-        replace(xml, "__NAME__", filename);
-        replace(xml, "__SAMPLE_FILE_NAME__", filename);
+        auto &name = names.at(block.wave_id);
+        replace_raw(xml, "__NAME__", name);
+        replace_raw(xml, "__SAMPLE_FILE_NAME__", name);
+
+        auto &info = WAVE_PROBES.get(get_sample_path(session, block));
+        replace(xml, "__SAMPLE_FILE_SIZE__", info.file_size);
+        replace(xml, "__SAMPLE_DEFAULT_DURATION__", info.frames);
+        replace(xml, "__SAMPLE_DEFAULT_SAMPLE_RATE__", info.valid ? info.sample_rate : session.sample_rate);
+        replace(xml, "__SAMPLE_VOLUME__", APPLY_BLOCK_GAIN && is_clip_gain(block) ? block.left_volume : 1.0);
 
         result += xml;
     }
     return result;
 }
 
-std::string generate_audio_tracks_xml(Session const &session)
+// Only what plays within [begin, end) session samples makes it into the
+// project, at its original position.
+std::string generate_audio_tracks_xml(Session const &session, uint64_t begin, uint64_t end)
 {
+    // Live cannot overlap clips, so each track becomes the segments that are
+    // actually heard, in time order.
+    std::vector<Segment> clips;
+    std::vector<size_t> track_clips{0};
+    size_t coalesced = 0;
+    auto timelines = build_timelines(session);
+    for (size_t i = 0; i < timelines.size(); ++i)
+    {
+        if (timelines[i].hidden_blocks())
+        {
+            logi("Track %@: trimmed %@ blocks overlapped by later ones", i + 1, timelines[i].hidden_blocks());
+        }
+        // Blocks split off one another play as a single clip.
+        auto segments = timelines[i].range(begin, end);
+        coalesced += coalesce(session, segments);
+        clips.insert(clips.end(), segments.begin(), segments.end());
+        track_clips.push_back(clips.size());
+    }
+    logi("%@ clips, %@ fewer by joining contiguous blocks", clips.size(), coalesced);
+
+    auto times = compute_clip_times(session, clips, get_wave_seconds(session, clips));
+    // Every clip of a wave shares its name.
+    std::unordered_map<unsigned, std::string> names;
+    for (auto &wave : session.waves)
+    {
+        // The name in the project's sample directory, whatever the case in
+        // the session.
+        names.emplace(wave.id, xml::escape_attribute(get_project_name(get_sample_path(wave))));
+    }
     std::string result;
     for (size_t i = 0; i < session.tracks.size(); ++i)
     {
         auto &track = session.tracks[i];
         auto xml = AUDIO_TRACK_XML;
         replace(xml, "__ID__", 8 + i);
+        replace(xml, "__USER_NAME__", track.title);
 
         auto volume = (track.left_volume + track.right_volume) / 2.0;
         auto pan = (track.right_volume - track.left_volume) / std::max(volume, std::numeric_limits<double>::epsilon());
         replace(xml, "__VOLUME__", volume);
         replace(xml, "__PAN__", pan);
-        replace(xml, "__MUTE__", track.mute);
+        // The value sits in the track's Mixer/On, its activator, which is
+        // true while the track plays.
+        replace(xml, "__MUTE__", !track.mute);
 
-        replace(xml, "__AUDIO_CLIPS__", generate_audio_clips_xml(session, i + 1));
+        replace_raw(xml, "__AUDIO_CLIPS__",
+                    generate_audio_clips_xml(session, clips, times, names, track_clips[i], track_clips[i + 1]));
         result += move(xml);
     }
     return result;
 }
 
+// Plans assume gzip shrinks project XML this much. Real sessions come out
+// around 20 times smaller; sessions of identical clips do better still.
+const double ASSUMED_GZIP_RATIO = 20;
+
+// Plans assume samples copy at this many bytes a second. Copies out of the
+// page cache run at over 2 GB/s, but archives are read from disk, where a
+// plain SSD or a fast hard disk manages about this.
+const double ASSUMED_COPY_BYTES_PER_SECOND = 200e6;
+
+// Plans assume resampling reads this many bytes of sample a second, on one
+// core: a 115 MB 48 kHz file converts to 44.1 kHz in about 1.25 s. Resampled
+// files are copied first all the same, see ses2als.sh.
+const double ASSUMED_RESAMPLE_BYTES_PER_SECOND = 90e6;
+
+// Appends the .ses files at or under `path`.
+void find_sessions(std::string const &path, std::vector<std::string> &out)
+{
+    struct stat status;
+    if (::stat(path.c_str(), &status) != 0 || !S_ISDIR(status.st_mode))
+    {
+        out.push_back(path);
+        return;
+    }
+    auto dir = ::opendir(path.c_str());
+    if (!dir)
+    {
+        logw("Cannot list %@: %@", path, std::strerror(errno));
+        return;
+    }
+    std::vector<std::string> names;
+    while (auto entry = ::readdir(dir))
+    {
+        names.push_back(entry->d_name);
+    }
+    ::closedir(dir);
+    std::sort(names.begin(), names.end());
+    for (auto &name : names)
+    {
+        auto child = path + "/" + name;
+        if (name == "." || name == ".." || ::stat(child.c_str(), &status) != 0)
+        {
+            continue;
+        }
+        auto extension = name.size() > 4 ? name.substr(name.size() - 4) : "";
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        if (S_ISDIR(status.st_mode))
+        {
+            find_sessions(child, out);
+        }
+        else if (extension == ".ses")
+        {
+            out.push_back(child);
+        }
+    }
+}
+
+// What converting the session at `path` would take, from its hdr, wav and blk
+// chunks and the headers of its samples alone. Safe to call from several
+// threads at once. `index` finds the samples of sessions in the session's directory.
+nlohmann::json plan_session(std::string const &path, LoadOptions const &options, SampleIndex const &index,
+                            SampleLibrary const *library, bool alternate_takes)
+{
+    nlohmann::json plan = {{"path", path}};
+    auto result = try_load_structure(path, options);
+    if (!result.status.ok())
+    {
+        plan["error"] = result.status.message();
+        return plan;
+    }
+    auto &session = result.session;
+    // Without the trks chunk, tracks run up to the last one holding a block,
+    // which is what the project gets clips on.
+    unsigned track_count = 0;
+    for (auto &block : session.blocks)
+    {
+        track_count = std::max(track_count, block.track);
+    }
+    session.tracks.resize(track_count, Track{1.0, 1.0, "", false});
+    resolve_takes(session, alternate_takes);
+    auto resolved = resolve_samples(session, index, library);
+
+    // Every distinct file once, as the project copies it.
+    std::map<std::string, WaveFile::Info> files;
+    for (auto &entry : resolved.paths)
+    {
+        files.emplace(entry.second, WAVE_PROBES.get(entry.second));
+    }
+    uint64_t sample_bytes = 0, resample_bytes = 0;
+    size_t resample_files = 0, unreadable_files = 0;
+    for (auto &file : files)
+    {
+        sample_bytes += file.second.file_size;
+        if (!file.second.valid)
+        {
+            ++unreadable_files;
+        }
+        else if (file.second.sample_rate != session.sample_rate)
+        {
+            ++resample_files;
+            resample_bytes += file.second.file_size;
+        }
+    }
+
+    // The clips the project would have, what they play, and roughly how much
+    // XML they take: numbers fill placeholders of about their own length, so
+    // the templates plus the names are close.
+    std::unordered_map<unsigned, std::string> names;
+    for (auto &wave : session.waves)
+    {
+        names.emplace(wave.id, xml::escape_attribute(get_wave_filename(wave)));
+    }
+    size_t clips = 0;
+    auto xml_bytes = ABLETON_XML.size() + session.tracks.size() * AUDIO_TRACK_XML.size();
+    // The frames of each file that are heard, as --consolidate would copy them.
+    std::map<std::string, std::vector<std::pair<uint64_t, uint64_t>>> used;
+    for (auto &timeline : build_timelines(session))
+    {
+        auto segments = timeline.segments();
+        coalesce(session, segments);
+        clips += segments.size();
+        for (auto &segment : segments)
+        {
+            auto &block = session.blocks[segment.block];
+            auto it = resolved.paths.find(block.wave_id);
+            if (it != resolved.paths.end())
+            {
+                used[it->second].push_back({segment.wave_offset, segment.wave_offset + segment.end - segment.start});
+            }
+            auto name = names.find(block.wave_id);
+            xml_bytes += AUDIO_CLIP_XML.size() + 2 * (name != names.end() ? name->second.size() : 0);
+        }
+    }
+    uint64_t used_sample_bytes = 0;
+    for (auto &entry : used)
+    {
+        auto &ranges = entry.second;
+        std::sort(ranges.begin(), ranges.end());
+        uint64_t frames = 0, covered = 0;
+        for (auto &range : ranges)
+        {
+            auto start = std::max(range.first, covered);
+            frames += range.second > start ? range.second - start : 0;
+            covered = std::max(covered, range.second);
+        }
+        used_sample_bytes += frames * WAVE_PROBES.get(entry.first).block_align;
+    }
+
+    plan["sample_rate"] = session.sample_rate;
+    plan["tracks"] = session.tracks.size();
+    plan["blocks"] = session.blocks.size();
+    plan["waves"] = session.waves.size();
+    plan["clips"] = clips;
+    plan["missing_samples"] = resolved.missing;
+    plan["sample_files"] = files.size();
+    plan["sample_bytes"] = sample_bytes;
+    plan["used_sample_bytes"] = used_sample_bytes;
+    plan["unreadable_files"] = unreadable_files;
+    plan["resample_files"] = resample_files;
+    plan["resample_bytes"] = resample_bytes;
+    plan["estimated_xml_bytes"] = xml_bytes;
+    plan["estimated_als_bytes"] = (uint64_t)(xml_bytes / ASSUMED_GZIP_RATIO);
+    // Copying and resampling samples dwarf writing the project.
+    plan["estimated_seconds"] =
+        sample_bytes / ASSUMED_COPY_BYTES_PER_SECOND + resample_bytes / ASSUMED_RESAMPLE_BYTES_PER_SECOND;
+    plan["sample_paths"] = nlohmann::json::array();
+    for (auto &file : files)
+    {
+        plan["sample_paths"].push_back(file.first);
+    }
+    return plan;
+}
+
+// Plans every session at or under `paths` in parallel and prints the plans
+// and their totals as one JSON document. Writes nothing else.
+void plan_sessions(std::vector<std::string> const &paths, LoadOptions const &options,
+                   std::vector<std::string> const &sample_roots, std::string const &library_path,
+                   bool alternate_takes)
+{
+    std::vector<std::string> sessions;
+    for (auto &path : paths)
+    {
+        find_sessions(path, sessions);
+    }
+    SampleIndex roots;
+    auto library = index_roots(roots, sample_roots, library_path);
+
+    // Archives keep many sessions per directory, so each directory is listed
+    // once for all of them.
+    std::mutex mutex;
+    std::unordered_map<std::string, std::unique_ptr<SampleIndex>> directories;
+    auto directory_index = [&](std::string path) -> SampleIndex const &
+    {
+        std::string directory = dirname(&path[0]);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = directories.find(directory);
+            if (it != directories.end())
+            {
+                return *it->second;
+            }
+        }
+        std::unique_ptr<SampleIndex> index(new SampleIndex);
+        index->add_root(directory, false);
+        index->add_index(roots);
+        std::lock_guard<std::mutex> lock(mutex);
+        return *directories.emplace(directory, std::move(index)).first->second;
+    };
+
+    std::vector<nlohmann::json> plans(sessions.size());
+    parallel_for(sessions.size(), [&](size_t i)
+    {
+        try
+        {
+            plans[i] = plan_session(sessions[i], options, directory_index(sessions[i]), library.get(),
+                                    alternate_takes);
+        }
+        catch (std::exception const &e)
+        {
+            plans[i] = {{"path", sessions[i]}, {"error", e.what()}};
+        }
+    });
+
+    nlohmann::json total = {{"sessions", plans.size()}, {"failed", 0}, {"missing_samples", 0},
+                            {"estimated_seconds", 0.0}};
+    const char *SUMMED[] = {"tracks", "clips", "sample_files", "sample_bytes", "used_sample_bytes",
+                            "resample_files", "resample_bytes", "estimated_xml_bytes", "estimated_als_bytes"};
+    for (auto key : SUMMED)
+    {
+        total[key] = 0;
+    }
+    // Shared samples count once here, as a batch that links instead of
+    // copying would move them.
+    std::map<std::string, uint64_t> unique;
+    for (auto &plan : plans)
+    {
+        if (plan.count("error"))
+        {
+            total["failed"] = total["failed"].get<uint64_t>() + 1;
+            continue;
+        }
+        for (auto key : SUMMED)
+        {
+            total[key] = total[key].get<uint64_t>() + plan[key].get<uint64_t>();
+        }
+        total["missing_samples"] = total["missing_samples"].get<uint64_t>() + plan["missing_samples"].size();
+        // One session after another, as ses2als.sh converts them.
+        total["estimated_seconds"] =
+            total["estimated_seconds"].get<double>() + plan["estimated_seconds"].get<double>();
+        for (auto &path : plan["sample_paths"])
+        {
+            unique.emplace(path.get<std::string>(), WAVE_PROBES.get(path.get<std::string>()).file_size);
+        }
+    }
+    uint64_t unique_bytes = 0;
+    for (auto &entry : unique)
+    {
+        unique_bytes += entry.second;
+    }
+    total["unique_sample_files"] = unique.size();
+    total["unique_sample_bytes"] = unique_bytes;
+    logi("Planned %@ sessions", plans.size());
+    std::cout << nlohmann::json{{"sessions", plans}, {"total", total}}.dump(2) << '\n';
+}
+
+// The catalog file of `path`, which may be the directory it was built for.
+std::string get_catalog_path(std::string const &path)
+{
+    struct stat status;
+    return ::stat(path.c_str(), &status) == 0 && S_ISDIR(status.st_mode) ? path + "/sessions.catalog" : path;
+}
+
+// Prints the sessions in the catalog at `path` that use any of the samples
+// `names`, one path per line.
+void query_catalog(std::string const &path, std::vector<std::string> const &names)
+{
+    SessionCatalog catalog(get_catalog_path(path));
+    if (catalog.probed())
+    {
+        logw("%@ was built with --probe and lists no samples", path);
+    }
+    std::set<size_t> sessions;
+    for (auto &name : names)
+    {
+        auto users = catalog.sessions_using(name);
+        sessions.insert(users.begin(), users.end());
+    }
+    for (auto session : sessions)
+    {
+        std::cout << catalog.session(session).path << "\n";
+    }
+}
+
+// "<start>-<end>" in seconds, either of which may be left out, to session
+// samples.
+std::pair<uint64_t, uint64_t> parse_range(std::string const &range, unsigned sample_rate)
+{
+    auto dash = range.find('-');
+    auto to_samples = [&](std::string const &text, uint64_t missing)
+    {
+        if (text.empty())
+        {
+            return missing;
+        }
+        size_t used = 0;
+        double seconds = -1;
+        try
+        {
+            seconds = std::stod(text, &used);
+        }
+        catch (std::exception const &)
+        {
+        }
+        if (used != text.size() || !(seconds >= 0))
+        {
+            THROW("Invalid time range: %@", range);
+        }
+        return (uint64_t)std::llround(seconds * sample_rate);
+    };
+    if (dash == std::string::npos)
+    {
+        THROW("Invalid time range, expected <start>-<end> in seconds: %@", range);
+    }
+    auto begin = to_samples(range.substr(0, dash), 0);
+    auto end = to_samples(range.substr(dash + 1), UINT64_MAX);
+    if (begin >= end)
+    {
+        THROW("Empty time range: %@", range);
+    }
+    return {begin, end};
+}
+
 int main(int argc, char **argv)
 {
+    logging::configure_from_environment();
+
     std::vector<std::string> args(argv, argv + argc);
-    if (args.size() != 2)
+    // render-mix <sesfile> <wavfile> mixes the session down instead of
+    // converting it, as a reference for the converted project. --stems does
+    // the same per track.
+    auto render_mix = args.size() > 1 && args[1] == "render-mix";
+    // plan <sesfiles or dirs>... estimates a batch conversion as JSON.
+    auto plan = args.size() > 1 && args[1] == "plan";
+    // index <dir>... catalogs the sessions under the directories, and
+    // query <catalog> <sample>... lists the sessions using the samples.
+    auto index = args.size() > 1 && args[1] == "index";
+    auto query = args.size() > 1 && args[1] == "query";
+    std::vector<std::string> paths;
+    LoadOptions options;
+    std::string resample_dir;
+    std::string consolidate_dir;
+    std::string gain_dir;
+    std::string stems_dir;
+    std::string range;
+    std::vector<std::string> sample_roots;
+    std::string sample_index;
+    bool alternate_takes = false;
+    bool list_samples = false;
+    bool minify = false;
+    std::string catalog;
+    bool probe = false;
+    for (size_t i = render_mix || plan || index || query ? 2 : 1; i < args.size(); ++i)
+    {
+        if (args[i] == "--salvage")
+        {
+            options.salvage = true;
+        }
+        else if (args[i] == "--resample" && i + 1 < args.size())
+        {
+            resample_dir = args[++i];
+        }
+        else if (args[i] == "--consolidate" && i + 1 < args.size())
+        {
+            consolidate_dir = args[++i];
+        }
+        else if (args[i] == "--gain" && i + 1 < args.size())
+        {
+            gain_dir = args[++i];
+        }
+        else if (args[i] == "--stems" && i + 1 < args.size())
+        {
+            stems_dir = args[++i];
+        }
+        else if (args[i] == "--sample-root" && i + 1 < args.size())
+        {
+            sample_roots.push_back(args[++i]);
+        }
+        else if (args[i] == "--sample-index" && i + 1 < args.size())
+        {
+            sample_index = args[++i];
+        }
+        else if (args[i] == "--list-samples")
+        {
+            list_samples = true;
+        }
+        else if (args[i] == "--alternate-takes")
+        {
+            alternate_takes = true;
+        }
+        else if (args[i] == "--minify")
+        {
+            minify = true;
+        }
+        else if (args[i] == "--range" && i + 1 < args.size())
+        {
+            range = args[++i];
+        }
+        else if (args[i] == "--catalog" && i + 1 < args.size())
+        {
+            catalog = args[++i];
+        }
+        else if (args[i] == "--probe")
+        {
+            probe = true;
+        }
+        else
+        {
+            paths.push_back(args[i]);
+        }
+    }
+    auto path_count_ok = plan || index ? !paths.empty() : query ? paths.size() >= 2
+                                                                 : paths.size() == (render_mix ? 2 : 1);
+    if (!path_count_ok)
     {
-        std::cerr << "Usage: " << args[0] << " <path/to/sesfile>\n";
+        auto options = " [--salvage] [--alternate-takes] [--sample-root <dir>]... [--sample-index <file>]"
+                       " [--resample <sample dir>] [--consolidate <sample dir>] [--gain <sample dir>] ";
+        std::cerr << "Usage: " << args[0] << options
+                  << "[--minify] [--range <start s>-<end s>] <path/to/sesfile>\n"
+                  << "       " << args[0] << " render-mix" << options << "<path/to/sesfile> <path/to/wavfile>\n"
+                  << "       " << args[0] << options << "--stems <stem dir> <path/to/sesfile>\n"
+                  << "       " << args[0]
+                  << " [--salvage] [--sample-root <dir>]... [--sample-index <file>] --list-samples <path/to/sesfile>\n"
+                  << "       " << args[0] << " plan [--salvage] [--alternate-takes] [--sample-root <dir>]..."
+                  << " [--sample-index <file>] [--minify] <path/to/sesfile or dir>...\n"
+                  << "       " << args[0] << " index [--salvage] [--probe] [--catalog <file>] <dir>...\n"
+                  << "       " << args[0] << " query <catalog file or dir> <sample name>...\n";
         return 1;
     }
 
-    auto dir = std::string(dirname(argv[0])) + "/..";
-    ABLETON_XML = load_string(dir + "/templates/Ableton.xml");
-    AUDIO_CLIP_XML = load_string(dir + "/templates/AudioClip.xml");
-    AUDIO_TRACK_XML = load_string(dir + "/templates/AudioTrack.xml");
+    if (index)
+    {
+        std::vector<std::string> sessions;
+        for (auto &path : paths)
+        {
+            find_sessions(path, sessions);
+        }
+        SessionCatalog::build(catalog.empty() ? paths[0] + "/sessions.catalog" : catalog, sessions, options, probe);
+        return 0;
+    }
+    if (query)
+    {
+        query_catalog(paths[0], {paths.begin() + 1, paths.end()});
+        return 0;
+    }
+
+    if (!render_mix && stems_dir.empty() && !list_samples)
+    {
+        auto dir = std::string(dirname(argv[0])) + "/..";
+        ABLETON_XML = load_string(dir + "/templates/Ableton.xml");
+        AUDIO_CLIP_XML = load_string(dir + "/templates/AudioClip.xml");
+        AUDIO_TRACK_XML = load_string(dir + "/templates/AudioTrack.xml");
+        if (minify)
+        {
+            auto size = ABLETON_XML.size() + AUDIO_CLIP_XML.size() + AUDIO_TRACK_XML.size();
+            for (auto xml : {&ABLETON_XML, &AUDIO_CLIP_XML, &AUDIO_TRACK_XML})
+            {
+                *xml = minify_template(*xml);
+            }
+            logi("Minified templates from %@ to %@ bytes", size,
+                 ABLETON_XML.size() + AUDIO_CLIP_XML.size() + AUDIO_TRACK_XML.size());
+        }
+    }
+    if (plan)
+    {
+        plan_sessions(paths, options, sample_roots, sample_index, alternate_takes);
+        return 0;
+    }
+
+    auto result = try_load_session(paths[0], options);
+    for (auto &skipped : result.skipped)
+    {
+        logw("Salvage: skipped %@ bytes at offset %@: %@", skipped.length, skipped.offset, skipped.cause.message());
+    }
+    if (!result.status.ok())
+    {
+        THROW("%@: %@", paths[0], result.status.message());
+    }
+    auto &session = result.session;
+    auto session_path = paths[0];
+    SESSION_DIR = dirname(&session_path[0]);
+    resolve_takes(session, alternate_takes);
+    find_samples(session, sample_roots, sample_index);
+    if (list_samples)
+    {
+        // What a project needs copied, one file per line: its path and, after
+        // a tab, the name it takes in the project's sample directory.
+        std::set<std::string> listed;
+        for (auto &wave : session.waves)
+        {
+            auto it = SOURCE_SAMPLES.find(wave.id);
+            if (it != SOURCE_SAMPLES.end() && listed.insert(it->second).second)
+            {
+                std::cout << it->second << "\t" << get_project_name(it->second) << "\n";
+            }
+        }
+        return 0;
+    }
+
+    std::vector<std::string> wave_paths;
+    for (auto &wave : session.waves)
+    {
+        wave_paths.push_back(get_source_path(wave));
+    }
+    WAVE_PROBES.probe_all(wave_paths);
+    for (auto &path : wave_paths)
+    {
+        if (!WAVE_PROBES.get(path).valid)
+        {
+            logw("Cannot read sample header: %@", path);
+        }
+    }
+    if (!resample_dir.empty())
+    {
+        resample_waves(session, resample_dir);
+    }
+    if (!consolidate_dir.empty())
+    {
+        consolidate_waves(session, consolidate_dir);
+    }
+    if (!gain_dir.empty())
+    {
+        bake_gains(session, gain_dir);
+    }
+
+    // After the stages above, so that mixes play what the project will.
+    std::vector<std::string> sample_paths;
+    for (auto &wave : session.waves)
+    {
+        sample_paths.push_back(get_sample_path(wave));
+    }
+    if (render_mix)
+    {
+        Mix::render(session, sample_paths, paths[1]);
+    }
+    if (!stems_dir.empty())
+    {
+        std::vector<std::string> stem_paths;
+        for (size_t i = 0; i < session.tracks.size(); ++i)
+        {
+            stem_paths.push_back(stems_dir + "/" + get_stem_filename(session, i));
+        }
+        Mix::render_stems(session, sample_paths, stem_paths);
+    }
+    if (render_mix || !stems_dir.empty())
+    {
+        return 0;
+    }
 
-    auto session = load_session(args[1]);
     auto ableton = ABLETON_XML;
     replace(ableton, "__TEMPO__", session.tempo.beats_per_minute);
     replace(ableton, "__TIME_SIGNATURE__", 197 + session.tempo.beats_per_bar);
-    replace(ableton, "__AUDIO_TRACKS__", generate_audio_tracks_xml(session));
+    uint64_t begin = 0, end = UINT64_MAX;
+    if (!range.empty())
+    {
+        std::tie(begin, end) = parse_range(range, session.sample_rate);
+    }
+    replace_raw(ableton, "__AUDIO_TRACKS__", generate_audio_tracks_xml(session, begin, end));
     std::cout << ableton << '\n';
 }
 
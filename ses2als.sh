@@ -3,7 +3,7 @@
 DIR="`dirname "$0"`"
 
 if [ -z "$2" ]; then
-    echo "Usage: $0 <path/to/ses/file> <new project name>"
+    echo "Usage: $0 <path/to/ses/file> <new project name> [--sample-root <dir>]..."
     exit 1
 fi
 
@@ -15,15 +15,20 @@ rmdir "$2 Project"
 cp -R "$DIR"/templates/project/ "$2 Project"
 mkdir -p "$2 Project/Samples/Imported"
 
-echo "Converting $1..."
-"$DIR"/bin/ses2als "$1" > "$2 Project/$2.xml"
-
+# Samples are looked up in the session's directory and under any --sample-root,
+# and copied under the names the project gives them, which differ only where
+# files of the same name come from different directories.
 echo "Copying samples..."
-SESDIR="`dirname "$1"`"
-rsync -P "$SESDIR/"*.wav "$2 Project/Samples/Imported"
+"$DIR"/bin/ses2als "${@:3}" --list-samples "$1" | while IFS=$'\t' read -r SAMPLE NAME; do
+    rsync -P "$SAMPLE" "$2 Project/Samples/Imported/$NAME"
+done
 
 echo "Sample copy complete."
 
+# Samples at a rate other than the session's are replaced by converted copies.
+echo "Converting $1..."
+"$DIR"/bin/ses2als "${@:3}" --minify --resample "$2 Project/Samples/Imported" "$1" > "$2 Project/$2.xml"
+
 pushd "$2 Project" > /dev/null
 
 gzip "$2.xml"
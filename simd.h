@@ -0,0 +1,37 @@
+#pragma once
+
+// Selects the vector instruction set available at compile time. Code using
+// these must keep a scalar path for when neither is defined.
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SIMD_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SIMD_NEON 1
+#endif
+
+#if SIMD_NEON
+#include <cstdint>
+
+// NEON has no movemask: `mask`, of bytes all set or all clear, narrowed to one
+// nibble per byte instead of one bit, the n-th byte in bits 4n to 4n + 3.
+inline uint64_t simd_nibble_mask(uint8x16_t mask)
+{
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(mask), 4)), 0);
+}
+#endif
+
+// AVX2 is not assumed at compile time. Functions marked SIMD_TARGET_AVX2 may
+// use its intrinsics and must only be called when simd_has_avx2().
+#if SIMD_SSE2 && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define SIMD_AVX2 1
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+
+inline bool simd_has_avx2()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#endif
@@ -0,0 +1,119 @@
+#include "xml.h"
+
+#include "simd.h"
+
+namespace xml
+{
+
+namespace
+{
+
+bool is_special(unsigned char c)
+{
+    return c < 0x20 || c == '&' || c == '<' || c == '>' || c == '"' || c == '\'';
+}
+
+// What a special character is written as, empty for the ones dropped.
+const char *reference(char c)
+{
+    switch (c)
+    {
+    case '&':
+        return "&amp;";
+    case '<':
+        return "&lt;";
+    case '>':
+        return "&gt;";
+    case '"':
+        return "&quot;";
+    case '\'':
+        return "&apos;";
+    case '\t':
+        return "&#9;";
+    case '\n':
+        return "&#10;";
+    case '\r':
+        return "&#13;";
+    default:
+        return "";
+    }
+}
+
+} // namespace
+
+size_t find_special(const char *text, size_t size)
+{
+    size_t i = 0;
+#if SIMD_SSE2
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i quot = _mm_set1_epi8('"');
+    const __m128i apos = _mm_set1_epi8('\'');
+    const __m128i control = _mm_set1_epi8(0x1f);
+    for (; i + 16 <= size; i += 16)
+    {
+        auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i));
+        // Unsigned bytes <= 0x1f are the ones the unsigned max leaves at 0x1f.
+        auto hits = _mm_cmpeq_epi8(_mm_max_epu8(bytes, control), control);
+        hits = _mm_or_si128(hits, _mm_or_si128(_mm_cmpeq_epi8(bytes, amp), _mm_cmpeq_epi8(bytes, lt)));
+        hits = _mm_or_si128(hits, _mm_or_si128(_mm_cmpeq_epi8(bytes, gt),
+                                               _mm_or_si128(_mm_cmpeq_epi8(bytes, quot), _mm_cmpeq_epi8(bytes, apos))));
+        if (auto mask = _mm_movemask_epi8(hits))
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#elif SIMD_NEON
+    const uint8x16_t amp = vdupq_n_u8('&');
+    const uint8x16_t lt = vdupq_n_u8('<');
+    const uint8x16_t gt = vdupq_n_u8('>');
+    const uint8x16_t quot = vdupq_n_u8('"');
+    const uint8x16_t apos = vdupq_n_u8('\'');
+    const uint8x16_t space = vdupq_n_u8(0x20);
+    for (; i + 16 <= size; i += 16)
+    {
+        auto bytes = vld1q_u8(reinterpret_cast<const uint8_t *>(text + i));
+        auto hits = vorrq_u8(vcltq_u8(bytes, space), vorrq_u8(vceqq_u8(bytes, amp), vceqq_u8(bytes, lt)));
+        hits = vorrq_u8(hits, vorrq_u8(vceqq_u8(bytes, gt), vorrq_u8(vceqq_u8(bytes, quot), vceqq_u8(bytes, apos))));
+        auto nibbles = simd_nibble_mask(hits);
+        if (nibbles)
+        {
+            return i + __builtin_ctzll(nibbles) / 4;
+        }
+    }
+#endif
+    for (; i < size; ++i)
+    {
+        if (is_special(text[i]))
+        {
+            return i;
+        }
+    }
+    return size;
+}
+
+void escape_attribute(std::string &out, const char *text, size_t size)
+{
+    for (size_t i = 0; i < size;)
+    {
+        auto special = i + find_special(text + i, size - i);
+        out.append(text + i, special - i);
+        if (special == size)
+        {
+            break;
+        }
+        out += reference(text[special]);
+        i = special + 1;
+    }
+}
+
+std::string escape_attribute(std::string const &text)
+{
+    std::string out;
+    out.reserve(text.size());
+    escape_attribute(out, text.data(), text.size());
+    return out;
+}
+
+} // namespace xml
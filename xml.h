@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace xml
+{
+
+// Index of the first character of text[0, size) that cannot appear as is in
+// a quoted attribute value: & < > " ' and control characters. size if there
+// is none.
+size_t find_special(const char *text, size_t size);
+
+// Appends text to out, escaped for a single- or double-quoted attribute
+// value. Tabs and line breaks become character references so that they
+// survive attribute normalization; other control characters, which XML 1.0
+// does not allow at all, are dropped.
+void escape_attribute(std::string &out, const char *text, size_t size);
+
+std::string escape_attribute(std::string const &text);
+
+} // namespace xml